@@ -0,0 +1,170 @@
+// Benchmark driver used by ./bench.sh
+//
+// Runs a command many times and appends one JSON line with its wall time
+// percentiles, peak RSS and syscall count to the output file. Every run gets
+// stdout redirected to /dev/null so terminal speed does not skew the numbers.
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "driver.h"
+
+typedef struct {
+    double wall_ms;
+    long max_rss_kb;
+    bool ok;
+} Run;
+
+static void redirect_stdout_to_null(void)
+{
+    int fd = open("/dev/null", O_WRONLY);
+    if (fd >= 0) {
+        dup2(fd, STDOUT_FILENO);
+        close(fd);
+    }
+}
+
+static bool run_once(char **cmd, const char *remove_before, Run *run)
+{
+    struct timespec start, end;
+    struct rusage usage;
+    int status = 0;
+
+    if (remove_before) unlink(remove_before);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "ERROR: fork: %s\n", strerror(errno));
+        return false;
+    }
+    if (pid == 0) {
+        redirect_stdout_to_null();
+        execvp(cmd[0], cmd);
+        fprintf(stderr, "ERROR: exec %s: %s\n", cmd[0], strerror(errno));
+        _exit(127);
+    }
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        fprintf(stderr, "ERROR: wait4: %s\n", strerror(errno));
+        return false;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    run->wall_ms = (end.tv_sec - start.tv_sec)*1e3 + (end.tv_nsec - start.tv_nsec)*1e-6;
+    run->max_rss_kb = usage.ru_maxrss;
+    run->ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    return true;
+}
+
+// Counts the syscalls of one extra run with ptrace, so the timed runs are not
+// slowed down by tracing. Returns -1 when tracing is not permitted.
+static long count_syscalls(char **cmd, const char *remove_before)
+{
+    int status = 0;
+    long stops = 0;
+
+    if (remove_before) unlink(remove_before);
+
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        redirect_stdout_to_null();
+        if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) < 0) _exit(126);
+        execvp(cmd[0], cmd);
+        _exit(127);
+    }
+
+    // The child stops with SIGTRAP once exec succeeded
+    if (waitpid(pid, &status, 0) < 0 || !WIFSTOPPED(status)) return -1;
+    ptrace(PTRACE_SETOPTIONS, pid, NULL, (void *)(long)(PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL));
+
+    int sig = 0;
+    for (;;) {
+        if (ptrace(PTRACE_SYSCALL, pid, NULL, (void *)(long)sig) < 0) break;
+        if (waitpid(pid, &status, 0) < 0) break;
+        if (WIFEXITED(status) || WIFSIGNALED(status)) break;
+        sig = 0;
+        if (WSTOPSIG(status) == (SIGTRAP | 0x80)) stops++;
+        else sig = WSTOPSIG(status);
+    }
+
+    // Every syscall stops the tracee twice, on entry and on exit. exit_group
+    // only has the entry stop.
+    return (stops + 1)/2;
+}
+
+static void usage(const char *program_name)
+{
+    fprintf(stderr, "Usage: %s -l <label> -n <runs> -o <results.jsonl> [-r <file to remove before each run>] -- <command...>\n", program_name);
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+    const char *program_name = shift(argv, argc);
+    const char *label = NULL, *output = NULL, *remove_before = NULL, *runs_arg = "0";
+    Run *runs = NULL;
+    double *wall_ms = NULL;
+    FILE *out = NULL;
+
+    Flag flags[] = {
+        { "-l", &label },
+        { "-n", &runs_arg },
+        { "-o", &output },
+        { "-r", &remove_before },
+    };
+    bool parsed = parse_flags(&argc, &argv, flags, sizeof(flags)/sizeof(flags[0]));
+    size_t runs_count = strtoul(runs_arg, NULL, 10);
+    if (!parsed || label == NULL || output == NULL || runs_count == 0 || argc <= 0) {
+        usage(program_name);
+        return 1;
+    }
+
+    runs = calloc(runs_count, sizeof(*runs));
+    wall_ms = calloc(runs_count, sizeof(*wall_ms));
+    if (runs == NULL || wall_ms == NULL) return_defer(1);
+
+    size_t failures = 0;
+    long max_rss_kb = 0;
+    double total_ms = 0;
+    for (size_t i = 0; i < runs_count; i++) {
+        if (!run_once(argv, remove_before, &runs[i])) return_defer(1);
+        if (!runs[i].ok) failures++;
+        if (runs[i].max_rss_kb > max_rss_kb) max_rss_kb = runs[i].max_rss_kb;
+        total_ms += runs[i].wall_ms;
+        wall_ms[i] = runs[i].wall_ms;
+    }
+    long syscalls = count_syscalls(argv, remove_before);
+
+    sort_doubles(wall_ms, runs_count);
+    double p50 = percentile(wall_ms, runs_count, 0.50);
+    double p99 = percentile(wall_ms, runs_count, 0.99);
+
+    printf("%-48s p50 %9.3fms  p99 %9.3fms  rss %7ldKiB  syscalls %6ld  failures %zu/%zu\n",
+           label, p50, p99, max_rss_kb, syscalls, failures, runs_count);
+
+    out = fopen(output, "a");
+    if (out == NULL) {
+        fprintf(stderr, "ERROR: %s: %s\n", output, strerror(errno));
+        return_defer(1);
+    }
+    fprintf(out, "{\"label\":");
+    json_string(out, label);
+    fprintf(out, ",\"runs\":%zu,\"failures\":%zu,\"p50_ms\":%.3f,\"p99_ms\":%.3f,\"mean_ms\":%.3f,\"max_rss_kb\":%ld,\"syscalls\":%ld}\n",
+            runs_count, failures, p50, p99, total_ms/runs_count, max_rss_kb, syscalls);
+
+defer:
+    if (out) fclose(out);
+    free(runs);
+    free(wall_ms);
+    return result;
+}
@@ -0,0 +1,80 @@
+#!/bin/bash -e
+
+# Latency benchmarks for the commands the shell hook and scripts run.
+#
+# Builds lore and the bench driver, fills synthetic databases and times every
+# command against each of them. Results are appended as JSON lines to
+# $BENCH_OUT (one line per fixture/command) so releases can be compared.
+#
+#   $ ./bench.sh
+#   $ BENCH_SIZES="0 100" BENCH_RATIOS="50" BENCH_RUNS=20 ./bench.sh
+#   $ LORE=/usr/local/bin/lore ./bench.sh      # skip building, bench this binary
+
+BUILD_DIR="./build/"
+BENCH_DIR=$BUILD_DIR"bench/"
+BENCH_SIZES=${BENCH_SIZES:-"0 100 10000 1000000"}
+BENCH_RATIOS=${BENCH_RATIOS:-"0 50 90"}   # percent of notifications already dismissed
+BENCH_RUNS=${BENCH_RUNS:-50}
+REV=$(git rev-parse --short HEAD 2> /dev/null || echo "unknown")
+BENCH_OUT=${BENCH_OUT:-$BENCH_DIR"results-$REV.jsonl"}
+
+if [ -z "$LORE" ]; then
+    ./build.sh home
+    LORE=$BUILD_DIR"lore"
+fi
+LORE=$(realpath "$LORE")
+
+mkdir -p $BENCH_DIR"fixtures"
+gcc -O2 -Wall -Wextra -o $BENCH_DIR"bench" bench.c
+BENCH=$(realpath $BENCH_DIR"bench")
+
+# Fixtures are cached between runs, regenerate with `rm -r build/bench/fixtures`
+populate() {
+    local dir=$1 size=$2 ratio=$3
+    if [ -f "$dir/.lore" ]; then return; fi
+    echo "Populating $size notifications, $ratio% dismissed..."
+    mkdir -p "$dir"
+    awk -v n="$size" -v r="$ratio" 'BEGIN { for (i = 0; i < n; i++) print (i % 100 < r ? "stale" : "alert"), "notification", i }' \
+        | HOME=$dir "$LORE" notify --stdin > /dev/null
+    if [ "$ratio" -gt 0 ] && [ "$size" -gt 0 ]; then
+        HOME=$dir "$LORE" dismiss --match stale > /dev/null
+    fi
+}
+
+bench() {
+    local label=$1
+    shift
+    HOME=$WORK_DIR "$BENCH" -l "$label" -n "$BENCH_RUNS" -o "$BENCH_OUT" "$@"
+}
+
+# Checkouts over their budget leave a snapshot refresh running in the background
+wait_for_refreshes() {
+    while pgrep -f "^$LORE checkout$" > /dev/null; do sleep 0.1; done
+}
+
+echo "Writing results to $BENCH_OUT"
+for size in $BENCH_SIZES; do
+    for ratio in $BENCH_RATIOS; do
+        if [ "$size" -eq 0 ] && [ "$ratio" -ne 0 ]; then continue; fi
+
+        FIXTURE=$BENCH_DIR"fixtures/$size-$ratio"
+        populate "$FIXTURE" "$size" "$ratio"
+
+        # Work on a copy so the fixture stays pristine for the next invocation
+        WORK_DIR=$(realpath $BENCH_DIR)"/work"
+        rm -rf "$WORK_DIR"
+        cp -r "$FIXTURE" "$WORK_DIR"
+
+        NAME="size=$size dismissed=$ratio%"
+        bench "$NAME checkout" -- "$LORE" checkout
+        # The render itself, without the latency budget cutting it short
+        LORE_CHECKOUT_BUDGET_MS=0 bench "$NAME checkout (no snapshot)" -r "$WORK_DIR/.lore.checkout" -- "$LORE" checkout
+        LORE_CHECKOUT_BUDGET_MS=20 bench "$NAME checkout (no snapshot, 20ms budget)" -r "$WORK_DIR/.lore.checkout" -- "$LORE" checkout
+        wait_for_refreshes
+        # notify and dismiss run the same number of times so the active count is restored
+        bench "$NAME notify" -- "$LORE" notify bench notification
+        bench "$NAME dismiss" -- "$LORE" dismiss 0
+        bench "$NAME remind" -- "$LORE" remind bench reminder 2030-01-01
+    done
+done
+rm -rf "$WORK_DIR"
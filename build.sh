@@ -7,11 +7,11 @@ SRC_FOLDER="./sqlite-amalgamation-3470000/"
 if ! ls $BUILD_DIR > /dev/null 2>&1; then
     echo "Building sqlite3..."
     mkdir -p -v $BUILD_DIR
-    gcc -DSQLITE_THREADSAFE=0 -DSQLITE_OMIT_LOAD_EXTENSION -I$SRC_FOLDER -o $BUILD_DIR"sqlite3.o" -c $SRC_FOLDER"sqlite3.c"
-# Need to rebuild sqlite if it doesn't exist
-elif ! ls $BUILD_DIR"sqlite3.o" > /dev/null 2>&1; then
+    gcc -DSQLITE_THREADSAFE=0 -DSQLITE_OMIT_LOAD_EXTENSION -DSQLITE_ENABLE_RTREE -I$SRC_FOLDER -o $BUILD_DIR"sqlite3.o" -c $SRC_FOLDER"sqlite3.c"
+# Need to rebuild sqlite if it doesn't exist or its flags below changed
+elif ! ls $BUILD_DIR"sqlite3.o" > /dev/null 2>&1 || [ build.sh -nt $BUILD_DIR"sqlite3.o" ]; then
     echo "Rebuilding sqlite3..."
-    gcc -DSQLITE_THREADSAFE=0 -DSQLITE_OMIT_LOAD_EXTENSION -I$SRC_FOLDER -o $BUILD_DIR"sqlite3.o" -c $SRC_FOLDER"sqlite3.c"
+    gcc -DSQLITE_THREADSAFE=0 -DSQLITE_OMIT_LOAD_EXTENSION -DSQLITE_ENABLE_RTREE -I$SRC_FOLDER -o $BUILD_DIR"sqlite3.o" -c $SRC_FOLDER"sqlite3.c"
 fi
 
 # Building lore
@@ -0,0 +1,71 @@
+// Helpers shared by the bench.c and stress.c drivers
+//
+// Both are single file programs built on their own by ./bench.sh and
+// ./stress.sh, so everything here is static and the header is included once
+// per driver.
+#ifndef DRIVER_H_
+#define DRIVER_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define return_defer(value) do { result = (value); goto defer; } while(0)
+
+#define shift(src, src_sz) ((src_sz)--, *(src)++)
+
+// A `-x <value>` command line flag, `value` is left alone unless it is given
+typedef struct {
+    const char *name;
+    const char **value;
+} Flag;
+
+// Consumes `-x <value>` pairs up to and including `--`, leaving the command
+// after it in `argv`. False on an unknown flag or one without a value.
+static bool parse_flags(int *argc, char ***argv, const Flag *flags, size_t flags_count)
+{
+    while (*argc > 0 && strcmp(**argv, "--") != 0) {
+        const char *name = shift(*argv, *argc);
+        if (*argc <= 0) return false;
+        const char *value = shift(*argv, *argc);
+
+        size_t i = 0;
+        while (i < flags_count && strcmp(flags[i].name, name) != 0) i++;
+        if (i == flags_count) return false;
+        *flags[i].value = value;
+    }
+    if (*argc > 0) shift(*argv, *argc);
+    return true;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void sort_doubles(double *items, size_t count)
+{
+    qsort(items, count, sizeof(*items), compare_doubles);
+}
+
+// Nearest rank percentile of sorted samples, 0 when there are none
+static double percentile(const double *sorted, size_t count, double p)
+{
+    if (count == 0) return 0;
+    size_t i = (size_t)(p*(count - 1) + 0.5);
+    return sorted[i];
+}
+
+static void json_string(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', f);
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+#endif // DRIVER_H_
@@ -0,0 +1,68 @@
+#!/bin/bash -e
+
+# iCalendar round trip test for `remind --export` and `remind --import`.
+#
+# Builds lore, exports reminders lore can only express with its own month end
+# rule, imports them into a fresh database and checks that exporting again
+# gives the same rules, then does the same for titles that need escaping and
+# folding. Exits non-zero on the first mismatch.
+#
+#   $ ./ics_test.sh
+#   $ LORE=/usr/local/bin/lore ./ics_test.sh   # skip building, test this binary
+
+BUILD_DIR="./build/"
+TEST_DIR=$BUILD_DIR"ics_test/"
+
+if [ -z "$LORE" ]; then
+    ./build.sh home
+    LORE=$BUILD_DIR"lore"
+fi
+LORE=$(realpath "$LORE")
+
+rm -rf $TEST_DIR
+mkdir -p $TEST_DIR"export" $TEST_DIR"import"
+TEST_DIR=$(realpath $TEST_DIR)
+
+fail() {
+    echo "FAIL: $1"
+    exit 1
+}
+
+# Rules without UID and DTSTAMP, which differ between exports
+rules() {
+    grep -v "^UID\|^DTSTAMP" "$1" | tr -d '\r'
+}
+
+# Day 31 moves to the last day of shorter months, which RFC 5545 only
+# expresses with BYMONTHDAY=-1 or BYSETPOS
+HOME=$TEST_DIR/export "$LORE" remind "rent" 2030-01-31 monthly > /dev/null
+HOME=$TEST_DIR/export "$LORE" remind "leap day" 2032-02-29 yearly > /dev/null
+HOME=$TEST_DIR/export "$LORE" remind "thirtieth" 2030-01-30 "monthly on 30" > /dev/null
+HOME=$TEST_DIR/export "$LORE" remind --export > $TEST_DIR/first.ics
+grep -q "^RRULE:FREQ=MONTHLY;BYMONTHDAY=-1" $TEST_DIR/first.ics || fail "day 31 is not exported as the last day of the month"
+grep -q "^RRULE:FREQ=MONTHLY;BYMONTHDAY=28,29,30;BYSETPOS=-1" $TEST_DIR/first.ics || fail "day 30 is not exported clamped"
+grep -q "^RRULE:FREQ=YEARLY;BYMONTH=2;BYMONTHDAY=28,29;BYSETPOS=-1" $TEST_DIR/first.ics || fail "February 29 is not exported clamped"
+
+HOME=$TEST_DIR/import "$LORE" remind --import $TEST_DIR/first.ics > /dev/null 2>&1
+HOME=$TEST_DIR/import "$LORE" remind --export > $TEST_DIR/second.ics
+diff <(rules $TEST_DIR/first.ics) <(rules $TEST_DIR/second.ics) || fail "export -> import -> export changed the calendar"
+
+# A plain BYMONTHDAY=31 skips shorter months, lore can not follow it
+rm -rf $TEST_DIR/skip
+mkdir -p $TEST_DIR/skip
+printf 'BEGIN:VCALENDAR\r\nBEGIN:VEVENT\r\nSUMMARY:skip\r\nDTSTART;VALUE=DATE:20300131\r\nRRULE:FREQ=MONTHLY;BYMONTHDAY=31\r\nEND:VEVENT\r\nEND:VCALENDAR\r\n' > $TEST_DIR/skip.ics
+HOME=$TEST_DIR/skip "$LORE" remind --import $TEST_DIR/skip.ics > /dev/null 2>&1
+HOME=$TEST_DIR/skip "$LORE" remind --export | grep -q "^RRULE" && fail "BYMONTHDAY=31 was imported as a clamped rule"
+
+# Line breaks in titles are escaped and long lines folded without going past
+# 75 octets, even when a multibyte character straddles the limit
+rm -rf $TEST_DIR/text $TEST_DIR/text_import
+mkdir -p $TEST_DIR/text $TEST_DIR/text_import
+HOME=$TEST_DIR/text "$LORE" remind "$(printf 'two\nlines, %s' "$(printf 'ü%.0s' {1..40})$(printf '€%.0s' {1..30})")" 2030-01-15 > /dev/null
+HOME=$TEST_DIR/text "$LORE" remind --export > $TEST_DIR/text.ics
+grep -q '^SUMMARY:two\\nlines\\, ' $TEST_DIR/text.ics || fail "line break in a title is not escaped"
+LC_ALL=C awk '{ sub(/\r$/, "") } length($0) > 75 { exit 1 }' $TEST_DIR/text.ics || fail "content line longer than 75 octets"
+HOME=$TEST_DIR/text_import "$LORE" remind --import $TEST_DIR/text.ics > /dev/null 2>&1
+HOME=$TEST_DIR/text_import "$LORE" remind | grep -q "two lines, ü" || fail "escaped title does not import"
+
+echo "OK"
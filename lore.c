@@ -1,133 +1,532 @@
 #include <ctype.h>
+#include <errno.h>
 #include <stddef.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <strings.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
 
 #include "sqlite3.h"
 
 #define return_defer(value) do { result = (value); goto defer; } while(0)
 
 #define LORE_FILENAME ".lore"
+#define SNAPSHOT_SUFFIX ".checkout"
 
 #define SB_INIT_CAP 256
 #define DB_INIT_CAP 528
+#define RENDER_FLUSH_THRESHOLD (64*1024)
+#define OUTPUT_CHUNKS 16
+#define IMPORT_DEFAULT_BATCH 10000
+
+#define DATE_SIZE sizeof("YYYY-MM-DD")
+#define DATE_MAX "9999-12-31" // text dates of schema versions before 7
+#define DAY_MIN INT_MIN
+#define DAY_MAX 2932896       // 9999-12-31 as a day number
+
+#define STR_(x) #x
+#define STR(x) STR_(x)
 
 #define shift(src, src_sz) (assert(src_sz > 0), (src_sz)--, *(src)++)
 
+#define ARENA_REGION_DEFAULT_CAP (8*1024)
+
+// Bump allocator that owns every allocation of a single lore invocation. Nothing
+// allocated from it is freed individually, the whole arena goes away at once.
+typedef struct Region Region;
+
+struct Region {
+    Region *next;
+    size_t count;
+    size_t capacity;
+    uintptr_t data[];
+};
+
+typedef struct {
+    Region *begin, *end;
+    size_t allocations;     // arena_alloc calls served
+    size_t bytes;           // bytes handed out
+    size_t mallocs;         // regions obtained from malloc
+} Arena;
+
+static Arena lore_arena = {0};
+
+Region *new_region(size_t capacity)
+{
+    Region *r = malloc(sizeof(Region) + sizeof(uintptr_t)*capacity);
+    assert(r != NULL && "ERROR: dynamic allocation error...");
+    r->next = NULL;
+    r->count = 0;
+    r->capacity = capacity;
+    return r;
+}
+
+void *arena_alloc(Arena *a, size_t size_bytes)
+{
+    size_t size = (size_bytes + sizeof(uintptr_t) - 1)/sizeof(uintptr_t);
+
+    if (a->end == NULL) {
+        assert(a->begin == NULL);
+        size_t capacity = size > ARENA_REGION_DEFAULT_CAP ? size : ARENA_REGION_DEFAULT_CAP;
+        a->begin = a->end = new_region(capacity);
+        a->mallocs++;
+    }
+
+    while (a->end->count + size > a->end->capacity && a->end->next != NULL) {
+        a->end = a->end->next;
+    }
+
+    if (a->end->count + size > a->end->capacity) {
+        size_t capacity = size > ARENA_REGION_DEFAULT_CAP ? size : ARENA_REGION_DEFAULT_CAP;
+        a->end->next = new_region(capacity);
+        a->end = a->end->next;
+        a->mallocs++;
+    }
+
+    void *result = &a->end->data[a->end->count];
+    a->end->count += size;
+    a->allocations++;
+    a->bytes += size*sizeof(uintptr_t);
+    return result;
+}
+
+// Grows `old` in place when it is the most recent allocation, copies otherwise
+void *arena_realloc(Arena *a, void *old, size_t old_size, size_t new_size)
+{
+    if (new_size <= old_size) return old;
+
+    if (old != NULL && a->end != NULL) {
+        size_t old_words = (old_size + sizeof(uintptr_t) - 1)/sizeof(uintptr_t);
+        size_t new_words = (new_size + sizeof(uintptr_t) - 1)/sizeof(uintptr_t);
+        Region *r = a->end;
+        if ((uintptr_t *)old + old_words == &r->data[r->count] &&
+                r->count - old_words + new_words <= r->capacity) {
+            r->count += new_words - old_words;
+            a->bytes += (new_words - old_words)*sizeof(uintptr_t);
+            return old;
+        }
+    }
+
+    void *result = arena_alloc(a, new_size);
+    if (old != NULL) memcpy(result, old, old_size);
+    return result;
+}
+
+char *arena_strdup(Arena *a, const char *str)
+{
+    size_t n = strlen(str);
+    char *dup = arena_alloc(a, n + 1);
+    memcpy(dup, str, n + 1);
+    return dup;
+}
+
+void arena_free(Arena *a)
+{
+    Region *r = a->begin;
+    while (r) {
+        Region *next = r->next;
+        free(r);
+        r = next;
+    }
+    a->begin = a->end = NULL;
+}
+
+// Opt-in tracing for the shell hook path. LORE_TRACE=1 reports to stderr, any
+// other value is taken as a file to append the report to. When unset every
+// trace point is a single branch on `trace.enabled`.
+#define TRACE_MAX_PHASES 64
+
+typedef struct {
+    const char *name;
+    uint64_t ns;
+} Trace_Phase;
+
+static struct {
+    bool enabled;
+    const char *output;
+    uint64_t start_ns;
+    uint64_t last_ns;
+    Trace_Phase phases[TRACE_MAX_PHASES];
+    size_t count;
+} trace = {0};
+
+uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+void trace_init(void)
+{
+    const char *env = getenv("LORE_TRACE");
+    if (env == NULL || *env == '\0' || strcmp(env, "0") == 0) return;
+    trace.enabled = true;
+    trace.output = strcmp(env, "1") == 0 ? NULL : env;
+    trace.start_ns = trace.last_ns = monotonic_ns();
+}
+
+void trace_record(const char *name)
+{
+    uint64_t now = monotonic_ns();
+    if (trace.count < TRACE_MAX_PHASES) {
+        trace.phases[trace.count++] = (Trace_Phase) { .name = name, .ns = now - trace.last_ns };
+    }
+    trace.last_ns = now;
+}
+
+// Attributes the time since the previous trace point to phase `name`
+#define trace_phase(name) do { if (trace.enabled) trace_record(name); } while (0)
+
 #define da_append(da, item)                                                   \
     do {                                                                      \
         if (da->count >= da->capacity) {                                      \
-            da->capacity = da->capacity == 0 ? DB_INIT_CAP : da->capacity*2;  \
-            da->items = realloc(da->items, da->capacity*sizeof(*da->items));   \
-            assert(da->items != NULL && "ERROR: Your db might be fucked\n");           \
+            size_t new_capacity = da->capacity == 0 ? DB_INIT_CAP : da->capacity*2; \
+            da->items = arena_realloc(&lore_arena, da->items,                 \
+                                      da->capacity*sizeof(*da->items),        \
+                                      new_capacity*sizeof(*da->items));       \
+            da->capacity = new_capacity;                                      \
         }                                                                     \
         da->items[da->count++] = (item);                                      \
     } while (0)
 
-bool initialize_file_creation(sqlite3 *db)
+typedef struct  {
+    char *items;
+    size_t count;
+    size_t capacity;
+} String_Builder;
+
+// Makes room for `n` more bytes
+void sb_reserve(String_Builder *sb, size_t n)
 {
-    sqlite3_stmt *stmt = NULL;
-    if (sqlite3_prepare_v2(db, "INSERT INTO File_Creation DEFAULT VALUES;", -1, &stmt, NULL) != SQLITE_OK) {
-        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
-        return false;
+    if (sb->count + n > sb->capacity) {
+        size_t new_capacity = sb->capacity == 0 ? SB_INIT_CAP : sb->capacity;
+        while (sb->count + n > new_capacity) {
+            new_capacity = new_capacity*2;
+        }
+        sb->items = arena_realloc(&lore_arena, sb->items, sb->capacity*sizeof(*sb->items), new_capacity*sizeof(*sb->items));
+        sb->capacity = new_capacity;
     }
+}
 
-    if (sqlite3_step(stmt) != SQLITE_DONE) {
-        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
-        return false;
+void sb_append_buf(String_Builder *sb, const char *buf, size_t n)
+{
+    sb_reserve(sb, n);
+    memcpy(sb->items + sb->count, buf, n*sizeof(*sb->items));
+    sb->count += n;
+}
+
+// printf into the builder. Formats straight into the spare capacity and only
+// formats a second time when that was too small.
+void sb_appendf(String_Builder *sb, const char *fmt, ...)
+{
+    va_list args;
+    size_t avail = sb->capacity - sb->count;
+
+    va_start(args, fmt);
+    int n = vsnprintf(avail > 0 ? sb->items + sb->count : NULL, avail, fmt, args);
+    va_end(args);
+    if (n < 0) return;
+
+    if ((size_t)n >= avail) {
+        sb_reserve(sb, n + 1);
+        va_start(args, fmt);
+        vsnprintf(sb->items + sb->count, n + 1, fmt, args);
+        va_end(args);
     }
+    sb->count += n;
+}
 
-    sqlite3_finalize(stmt);
+void sb_append_cstr(String_Builder *sb, const char *str)
+{
+    sb_append_buf(sb, str, strlen(str));
+}
 
-    return true;
+void sb_append_null(String_Builder *sb)
+{
+    sb_append_buf(sb, "", 1);
 }
 
-bool update_file_creation_message(sqlite3 *db) 
+// ** Dates **
+//
+// Dates are day numbers (days since 1970-01-01), in the database as well, so
+// range queries compare integers and recurrences are plain arithmetic.
+
+// http://howardhinnant.github.io/date_algorithms.html
+int days_from_civil(int y, int m, int d)
 {
-    bool result = true;
-    sqlite3_stmt *stmt = NULL;
-    unsigned int non_null_value = 3;
+    y -= m <= 2;
+    int era = (y >= 0 ? y : y - 399)/400;
+    int yoe = y - era*400;
+    int doy = (153*(m > 2 ? m - 3 : m + 9) + 2)/5 + d - 1;
+    int doe = yoe*365 + yoe/4 - yoe/100 + doy;
+    return era*146097 + doe - 719468;
+}
 
-    // Check if table is empty
-    int ret = sqlite3_prepare_v2(db, "SELECT COUNT(*) FROM File_Creation;", -1, &stmt, NULL);
-    if (ret != SQLITE_OK) {
-        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
-        return_defer(false);
+void civil_from_days(int z, int *y, int *m, int *d)
+{
+    z += 719468;
+    int era = (z >= 0 ? z : z - 146096)/146097;
+    int doe = z - era*146097;
+    int yoe = (doe - doe/1460 + doe/36524 - doe/146096)/365;
+    int doy = doe - (365*yoe + yoe/4 - yoe/100);
+    int mp = (5*doy + 2)/153;
+    *d = doy - (153*mp + 2)/5 + 1;
+    *m = mp < 10 ? mp + 3 : mp - 9;
+    *y = yoe + era*400 + (*m <= 2);
+}
+
+// 0 is Sunday, 1970-01-01 was a Thursday
+int weekday_of(int day)
+{
+    return ((day + 4)%7 + 7)%7;
+}
+
+int days_in_month(int y, int m)
+{
+    static const int days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    if (m == 2 && y%4 == 0 && (y%100 != 0 || y%400 == 0)) return 29;
+    return days[m - 1];
+}
+
+void day_to_date(int day, char date[DATE_SIZE])
+{
+    int y, m, d;
+    civil_from_days(day, &y, &m, &d);
+    snprintf(date, DATE_SIZE, "%04d-%02d-%02d", y, m, d);
+}
+
+int local_today(void)
+{
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    return days_from_civil(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+}
+
+#define TIMESTAMP_SIZE sizeof("YYYY-MM-DD HH:MM:SS")
+
+// Timestamps are stored as epoch seconds. The UTC offset is looked up once and
+// reused for the whole window around it in which the zone keeps that offset,
+// so a listing typically needs a handful of lookups. The window spans up to
+// TZ_WINDOW on either side, ending exactly at the transitions found in there;
+// zones are assumed not to change their offset twice within TZ_WINDOW.
+#define TZ_WINDOW 86400
+
+static struct {
+    bool valid;
+    int64_t start;  // [start, end) has `offset`
+    int64_t end;
+    long offset;
+} tz_cache;
+
+static long utc_offset_lookup(int64_t ts)
+{
+    time_t t = (time_t)ts;
+    struct tm tm;
+    localtime_r(&t, &tm);
+    return tm.tm_gmtoff;
+}
+
+// First second in (lo, hi] with another offset than `lo`, given that `hi` has one
+static int64_t tz_transition(int64_t lo, int64_t hi)
+{
+    long offset = utc_offset_lookup(lo);
+    while (hi - lo > 1) {
+        int64_t mid = lo + (hi - lo)/2;
+        if (utc_offset_lookup(mid) == offset) lo = mid;
+        else hi = mid;
     }
+    return hi;
+}
 
-    ret = sqlite3_step(stmt);
-    if (ret != SQLITE_ROW) {
-        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
-        return_defer(false);
+long local_offset_at(int64_t ts)
+{
+    if (!tz_cache.valid || ts < tz_cache.start || ts >= tz_cache.end) {
+        long offset = utc_offset_lookup(ts);
+        int64_t start = ts - TZ_WINDOW, end = ts + TZ_WINDOW;
+        if (utc_offset_lookup(start) != offset) start = tz_transition(start, ts);
+        if (utc_offset_lookup(end) != offset) end = tz_transition(ts, end);
+        tz_cache.valid = true;
+        tz_cache.start = start;
+        tz_cache.end = end;
+        tz_cache.offset = offset;
     }
+    return tz_cache.offset;
+}
 
-    int row_count = sqlite3_column_int(stmt, 0);
-    sqlite3_finalize(stmt);
-    stmt = NULL;
-    if (row_count == 0) {
-        // Update first row since it doesnt exist
-        if (!initialize_file_creation(db)) return_defer(false);
-    } else {
-        // Table not empty, no update needed
-        return_defer(false);
+// Local time as YYYY-MM-DD HH:MM:SS, what `datetime(ts, 'localtime')` used to print
+void format_local_timestamp(int64_t ts, char buf[TIMESTAMP_SIZE])
+{
+    int64_t local = ts + local_offset_at(ts);
+    int64_t day = local/86400 - (local%86400 < 0);
+    int secs = (int)(local - day*86400);
+    int hms[] = {secs/3600, secs/60%60, secs%60};
+
+    day_to_date((int)day, buf);
+    for (int i = 0; i < 3; i++) {
+        buf[10 + i*3] = i == 0 ? ' ' : ':';
+        buf[11 + i*3] = '0' + hms[i]/10;
+        buf[12 + i*3] = '0' + hms[i]%10;
     }
+    buf[19] = '\0';
+}
 
-    // Reselect first row
-    ret = sqlite3_prepare_v2(db, "SELECT id, active, datetime(created_at, 'localtime') FROM File_Creation LIMIT 1;", -1, &stmt, NULL);
-    if (ret != SQLITE_OK || sqlite3_step(stmt) != SQLITE_ROW) {
-        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
-        return_defer(false);
+static const char *weekday_names[] = {"sunday", "monday", "tuesday", "wednesday", "thursday", "friday", "saturday"};
+
+// Accepts any prefix of at least three letters, `mon`, `tues`, `thursday`...
+static int parse_weekday(const char *word)
+{
+    size_t n = strlen(word);
+    if (n < 3) return -1;
+    for (int wd = 0; wd < 7; wd++) {
+        if (n <= strlen(weekday_names[wd]) && strncasecmp(word, weekday_names[wd], n) == 0) return wd;
+    }
+    return -1;
+}
+
+// YYYY-MM-DD in a single pass, the year takes up to 4 digits and month and day
+// up to 2 like the shape the old checker accepted, but the result has to be an
+// actual calendar day.
+bool parse_absolute_date(const char *s, int *day)
+{
+    static const int max_digits[] = {4, 2, 2};
+    int fields[3] = {0};
+    int field = 0, digits = 0;
+
+    for (; *s; s++) {
+        if (isdigit((unsigned char)*s)) {
+            if (++digits > max_digits[field]) return false;
+            fields[field] = fields[field]*10 + (*s - '0');
+        } else if (*s == '-' && digits > 0 && field < 2) {
+            field++;
+            digits = 0;
+        } else {
+            return false;
+        }
     }
+    if (field != 2 || digits == 0) return false;
 
-    int id = sqlite3_column_int(stmt, 0);
-    if (sqlite3_column_type(stmt, 1) != SQLITE_NULL) {
-        return_defer(false);
-    } 
+    int y = fields[0], m = fields[1], d = fields[2];
+    if (m < 1 || m > 12 || d < 1 || d > days_in_month(y, m)) return false;
+    *day = days_from_civil(y, m, d);
+    return true;
+}
 
-    sqlite3_finalize(stmt);
-    stmt = NULL;
+static const struct {
+    const char *word;
+    int offset;
+} relative_days[] = {
+    {"yesterday", -1},
+    {"today",      0},
+    {"tomorrow",   1},
+};
+
+// Any date the command line accepts: YYYY-MM-DD, `today`, `tomorrow`,
+// `yesterday`, `+3d`, `-1w`, or a weekday name for its next occurrence with
+// today included. Relative forms count from `today`.
+bool parse_date(const char *s, int today, int *day)
+{
+    if (isdigit((unsigned char)*s)) return parse_absolute_date(s, day);
+
+    if ((*s == '+' || *s == '-') && isdigit((unsigned char)s[1])) {
+        char *end = NULL;
+        long n = strtol(s + 1, &end, 10);
+        if (n > 100000) return false;
+        if (*end == 'w' && end[1] == '\0') n *= 7;
+        else if (*end != 'd' || end[1] != '\0') return false;
+        *day = today + (*s == '-' ? -n : n);
+        return true;
+    }
 
-    // Prepare update statement
-    ret = sqlite3_prepare_v2(db, "UPDATE File_Creation SET active = ? where id = ?;", -1, &stmt, NULL);
-    if (ret != SQLITE_OK) {
-        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
-        return_defer(false);
+    for (size_t i = 0; i < sizeof(relative_days)/sizeof(relative_days[0]); i++) {
+        if (strcasecmp(s, relative_days[i].word) == 0) {
+            *day = today + relative_days[i].offset;
+            return true;
+        }
     }
 
-    if (sqlite3_bind_int(stmt, 1, non_null_value) != SQLITE_OK || 
-            sqlite3_bind_int(stmt, 2, id) != SQLITE_OK) {
+    int wd = parse_weekday(s);
+    if (wd < 0) return false;
+    *day = today + (wd - weekday_of(today) + 7)%7;
+    return true;
+}
+
+// lore_day(text) for migrations converting stored dates, NULL if it is not a date
+static void sql_lore_day(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+    (void) argc;
+    const char *text = (const char *)sqlite3_value_text(argv[0]);
+    int day;
+    if (text && parse_absolute_date(text, &day)) sqlite3_result_int(ctx, day);
+    else sqlite3_result_null(ctx);
+}
+
+// Switches the database to WAL, see `open_database`. sqlite answers with the
+// journal mode it ended up in, which stays as it was for databases that cannot
+// use WAL (e.g. on a network file system). lore works in any mode, only slower
+// under concurrent use, so that is a warning and not an error.
+static bool enable_wal_journal(sqlite3 *db)
+{
+    bool result = true;
+    sqlite3_stmt *stmt = NULL;
+
+    if (sqlite3_prepare_v2(db, "PRAGMA journal_mode = WAL;", -1, &stmt, NULL) != SQLITE_OK
+            || sqlite3_step(stmt) != SQLITE_ROW) {
         fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
         return_defer(false);
     }
 
-    if (sqlite3_step(stmt) != SQLITE_DONE) {
-        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
-        return_defer(false);
+    const char *mode = (const char *)sqlite3_column_text(stmt, 0);
+    if (mode == NULL || strcmp(mode, "wal") != 0) {
+        fprintf(stderr, "WARNING: could not switch the database to WAL, journal mode is %s\n", mode ? mode : "unknown");
     }
 
 defer:
-    if (stmt) sqlite3_finalize(stmt);
+    sqlite3_finalize(stmt);
     return result;
 }
 
-bool create_schema(sqlite3 *db)
-{
-    const char *sql =
+// One schema step. `sql` runs inside the migration transaction, while
+// `before_transaction` is for changes sqlite refuses inside one, such as the
+// journal mode. It runs on every migrating open until the step is committed,
+// so it has to be idempotent.
+typedef struct {
+    const char *sql;
+    bool (*before_transaction)(sqlite3 *db);
+} Migration;
+
+#define LORE_SCHEMA_VERSION ((int)(sizeof(migrations)/sizeof(migrations[0])))
+
+// Each entry brings the database from `user_version == i` to `i + 1`. Shipped
+// migrations are never edited, new schema changes are appended as new entries.
+// The first one is written with `IF NOT EXISTS` so databases created before
+// `user_version` was tracked upgrade cleanly.
+static const Migration migrations[] = {
+    // 0 -> 1: initial schema + first run marker
+    { .sql =
         "CREATE TABLE IF NOT EXISTS Notifications (\n"
         "    id INTEGER PRIMARY KEY ASC,\n"
         "    title TEXT NOT NULL,\n"
         "    created_at DATETIME NOT NULL DEFAULT CURRENT_TIMESTAMP,\n"
         "    dismissed_at DATETIME DEFAULT NULL\n"
-        ")\n";
-    if (sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK) {
-        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
-        return false;
-    }
-
-    sql =
+        ");\n"
         "CREATE TABLE IF NOT EXISTS Reminders (\n"
         "    id INTEGER PRIMARY KEY ASC,\n"
         "    title TEXT NOT NULL,\n"
@@ -135,324 +534,2740 @@ bool create_schema(sqlite3 *db)
         "    scheduled_at DATE NOT NULL,\n"
         "    period TEXT DEFAULT NULL,\n"
         "    finished_at DATETIME DEFAULT NULL\n"
-        ")\n";
-    if (sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK) {
-        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
-        return false;
-    }
-
-    sql =
+        ");\n"
         "CREATE TABLE IF NOT EXISTS File_Creation (\n"
         "    id INTEGER PRIMARY KEY ASC,\n"
         "    active INTEGER DEFAULT NULL,\n"
         "    created_at DATETIME NOT NULL DEFAULT CURRENT_TIMESTAMP\n"
-        ")\n";
-    if (sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK) {
-        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
-        return false;
-    }
-
-    sql =
+        ");\n"
         "CREATE TABLE IF NOT EXISTS Add_Notes (\n"
         "    id INTEGER PRIMARY KEY ASC,\n"
         "    primary_display INTEGER DEFAULT 0,\n"
         "    notes_absolute_path_name text NOT NULL,\n"
-        "    notes_absolute_preferred_name text DEFAULT NULL,\n" 
+        "    notes_absolute_preferred_name text DEFAULT NULL,\n"
         "    selection_display INTEGER DEFAULT 0,\n" // going to be obtained from reading the first line of a file and parsing for `# {whatever chose name here}` if not exist - close file and use absolute path.
         "    shown INTEGER DEFAULT NULL,\n"
         "    created_at DATETIME NOT NULL DEFAULT CURRENT_TIMESTAMP\n"
-        ")\n";
-    if (sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK) {
-        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
-        return false;
+        ");\n"
+        "INSERT INTO File_Creation (active) SELECT 3 WHERE NOT EXISTS (SELECT 1 FROM File_Creation);\n" },
+
+    // 1 -> 2: key/value table for bookkeeping. The `generation` row is no
+    // longer maintained, the checkout snapshot goes by file identity instead.
+    { .sql =
+        "CREATE TABLE Lore_Meta (\n"
+        "    key TEXT PRIMARY KEY,\n"
+        "    value INTEGER NOT NULL\n"
+        ") WITHOUT ROWID;\n"
+        "INSERT INTO Lore_Meta (key, value) VALUES ('generation', 0);\n" },
+
+    // 2 -> 3: partial covering index so checkout never walks dismissed history.
+    // `dismissed_at` is always NULL in it, but sqlite only treats the index as
+    // covering when every referenced column is part of it.
+    { .sql =
+        "CREATE INDEX IF NOT EXISTS Notifications_Active\n"
+        "    ON Notifications (id, title, created_at, dismissed_at)\n"
+        "    WHERE dismissed_at IS NULL;\n" },
+
+    // 3 -> 4: unfinished reminders by date for the due window queries
+    { .sql =
+        "CREATE INDEX IF NOT EXISTS Reminders_Due\n"
+        "    ON Reminders (scheduled_at, id, title, period, finished_at)\n"
+        "    WHERE finished_at IS NULL;\n" },
+
+    // 4 -> 5: next due watermark, the earliest unfinished reminder or DATE_MAX
+    { .sql =
+        "INSERT INTO Lore_Meta (key, value)\n"
+        "    SELECT 'next_due', coalesce(MIN(scheduled_at), '"DATE_MAX"') FROM Reminders WHERE finished_at IS NULL;\n" },
+
+    // 5 -> 6: packed `Recurrence` of periodic reminders, `period` keeps the readable form
+    { .sql =
+        "ALTER TABLE Reminders ADD COLUMN recurrence INTEGER DEFAULT NULL;\n" },
+
+    // 6 -> 7: scheduled_at as a day number. Dates the old shape-only checker
+    // let through (month 13, day 40) become due today so they get noticed.
+    { .sql =
+        "UPDATE Reminders SET scheduled_at = coalesce(lore_day(scheduled_at), CAST(julianday('now', 'localtime') - 2440587.5 AS INTEGER))\n"
+        "    WHERE typeof(scheduled_at) = 'text';\n"
+        "UPDATE Lore_Meta SET value = coalesce((SELECT MIN(scheduled_at) FROM Reminders WHERE finished_at IS NULL), "STR(DAY_MAX)")\n"
+        "    WHERE key = 'next_due';\n" },
+
+    // 7 -> 8: timestamps as epoch seconds instead of UTC text. The columns keep
+    // their CURRENT_TIMESTAMP defaults, so every insert provides its own.
+    { .sql =
+        "UPDATE Notifications SET created_at = unixepoch(created_at) WHERE typeof(created_at) = 'text';\n"
+        "UPDATE Notifications SET dismissed_at = unixepoch(dismissed_at) WHERE typeof(dismissed_at) = 'text';\n"
+        "UPDATE Reminders SET created_at = unixepoch(created_at) WHERE typeof(created_at) = 'text';\n"
+        "UPDATE Reminders SET finished_at = unixepoch(finished_at) WHERE typeof(finished_at) = 'text';\n"
+        "UPDATE Add_Notes SET created_at = unixepoch(created_at) WHERE typeof(created_at) = 'text';\n"
+        "UPDATE File_Creation SET created_at = unixepoch(created_at) WHERE typeof(created_at) = 'text';\n" },
+
+    // 8 -> 9: end of recurring series and an R*Tree over the days every
+    // unfinished reminder can still fall on, [scheduled_at, repeat_until] for
+    // recurring ones and the single scheduled day for one-offs
+    { .sql =
+        "ALTER TABLE Reminders ADD COLUMN repeat_until INTEGER DEFAULT NULL;\n"
+        "CREATE VIRTUAL TABLE Reminder_Spans USING rtree_i32(id, first_day, last_day);\n"
+        "INSERT INTO Reminder_Spans (id, first_day, last_day)\n"
+        "    SELECT id, scheduled_at, CASE WHEN recurrence IS NULL THEN scheduled_at ELSE "STR(DAY_MAX)" END\n"
+        "    FROM Reminders WHERE finished_at IS NULL;\n" },
+
+    // 9 -> 10: WAL journal
+    { .before_transaction = enable_wal_journal },
+};
+
+
+// Deadline of the running command, see `budget_start`. Statements it cuts short
+// fail on purpose and their callers fall back, so those errors are not reported.
+typedef struct {
+    uint64_t deadline_ns; // 0 when there is no budget
+    bool exceeded;
+} Budget;
+
+static Budget lore_budget = {0};
+
+void report_sqlite_error(sqlite3 *db)
+{
+    if (lore_budget.exceeded) return;
+    fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+}
+
+// Every statement lore runs, prepared lazily once per connection and reset
+// between uses instead of being re-parsed by each function call.
+typedef enum {
+    STMT_BEGIN_IMMEDIATE,
+    STMT_COMMIT,
+    STMT_ROLLBACK,
+    STMT_USER_VERSION,
+    STMT_COUNT_SCHEMA_OBJECTS,
+    STMT_LOAD_ACTIVE_NOTIFICATIONS,
+    STMT_INSERT_NOTIFICATION,
+    STMT_DISMISS_NOTIFICATION,
+    STMT_DISMISS_NOTIFICATION_AT,
+    STMT_LOAD_ACTIVE_IDS,
+    STMT_DISMISS_NOTIFICATIONS_IN,
+    STMT_DISMISS_ALL_NOTIFICATIONS,
+    STMT_DISMISS_MATCHING_NOTIFICATIONS,
+    STMT_INSERT_REMINDER,
+    STMT_LOAD_REMINDERS,
+    STMT_COUNT_REMINDERS_BEFORE,
+    STMT_LOAD_REMINDER_IDS_BEFORE,
+    STMT_LOAD_SERIES_BEFORE,
+    STMT_REMINDER_AT,
+    STMT_FINISH_REMINDER,
+    STMT_ADVANCE_REMINDER,
+    STMT_GET_NEXT_DUE,
+    STMT_LOWER_NEXT_DUE,
+    STMT_REFRESH_NEXT_DUE,
+    STMT_NEXT_DUE_AFTER,
+    STMT_LOAD_CALENDAR,
+    STMT_DATA_VERSION,
+    STMT_LOAD_PENDING_REMINDERS,
+    STMT_LOAD_REMINDER,
+    STMT_EXPORT_REMINDERS,
+    STMT_INSERT_SPAN,
+    STMT_MOVE_SPAN,
+    STMT_DELETE_SPAN,
+    STMT_COUNT_NOTES,
+    STMT_INSERT_NOTES,
+    STMT_LOAD_NOTES_PATHS,
+    COUNT_STMTS,
+} Stmt_Kind;
+
+static const char *stmt_sql[COUNT_STMTS] = {
+    [STMT_BEGIN_IMMEDIATE]           = "BEGIN IMMEDIATE;",
+    [STMT_COMMIT]                    = "COMMIT;",
+    [STMT_ROLLBACK]                  = "ROLLBACK;",
+    [STMT_USER_VERSION]              = "PRAGMA user_version;",
+    [STMT_COUNT_SCHEMA_OBJECTS]      = "SELECT COUNT(*) FROM sqlite_master;",
+    [STMT_LOAD_ACTIVE_NOTIFICATIONS] = "SELECT id, title, created_at FROM Notifications WHERE dismissed_at IS NULL ORDER BY id;",
+    [STMT_INSERT_NOTIFICATION]       = "INSERT INTO Notifications (title, created_at) VALUES (?, unixepoch())",
+    [STMT_DISMISS_NOTIFICATION]      = "UPDATE Notifications SET dismissed_at = unixepoch() WHERE id = ?",
+    [STMT_DISMISS_NOTIFICATION_AT]   = "UPDATE Notifications SET dismissed_at = unixepoch() WHERE id = "
+                                       "(SELECT id FROM Notifications WHERE dismissed_at IS NULL ORDER BY id LIMIT 1 OFFSET ?)",
+    [STMT_LOAD_ACTIVE_IDS]           = "SELECT id FROM Notifications WHERE dismissed_at IS NULL ORDER BY id;",
+    [STMT_DISMISS_NOTIFICATIONS_IN]  = "UPDATE Notifications SET dismissed_at = unixepoch() WHERE id IN (SELECT value FROM json_each(?))",
+    [STMT_DISMISS_ALL_NOTIFICATIONS] = "UPDATE Notifications SET dismissed_at = unixepoch() WHERE dismissed_at IS NULL",
+    [STMT_DISMISS_MATCHING_NOTIFICATIONS] = "UPDATE Notifications SET dismissed_at = unixepoch() WHERE dismissed_at IS NULL AND instr(title, ?) > 0",
+    [STMT_INSERT_REMINDER]           = "INSERT INTO Reminders (title, scheduled_at, period, recurrence, repeat_until, created_at) VALUES (?, ?, ?, ?, ?, unixepoch())",
+    [STMT_LOAD_REMINDERS]            = "SELECT title, scheduled_at, period FROM Reminders "
+                                       "WHERE finished_at IS NULL AND scheduled_at BETWEEN ?1 AND ?2 ORDER BY scheduled_at, id;",
+    [STMT_COUNT_REMINDERS_BEFORE]    = "SELECT COUNT(*) FROM Reminders WHERE finished_at IS NULL AND scheduled_at < ?;",
+    [STMT_LOAD_REMINDER_IDS_BEFORE]  = "SELECT id FROM Reminders WHERE finished_at IS NULL AND scheduled_at < ? ORDER BY scheduled_at, id;",
+    [STMT_LOAD_SERIES_BEFORE]        = "SELECT r.id, r.title, r.scheduled_at, r.period, r.recurrence, r.repeat_until FROM Reminder_Spans s JOIN Reminders r ON r.id = s.id "
+                                       "WHERE s.first_day < ?1 AND s.last_day >= ?1 AND r.recurrence IS NOT NULL;",
+    [STMT_REMINDER_AT]               = "SELECT id, scheduled_at, recurrence, repeat_until FROM Reminders WHERE id = "
+                                       "(SELECT id FROM Reminders WHERE finished_at IS NULL ORDER BY scheduled_at, id LIMIT 1 OFFSET ?);",
+    [STMT_FINISH_REMINDER]           = "UPDATE Reminders SET finished_at = unixepoch() WHERE id = ?",
+    [STMT_ADVANCE_REMINDER]          = "UPDATE Reminders SET scheduled_at = ? WHERE id = ?",
+    [STMT_GET_NEXT_DUE]              = "SELECT value FROM Lore_Meta WHERE key = 'next_due';",
+    [STMT_LOWER_NEXT_DUE]            = "UPDATE Lore_Meta SET value = min(value, ?) WHERE key = 'next_due';",
+    [STMT_REFRESH_NEXT_DUE]          = "UPDATE Lore_Meta SET value = "
+                                       "coalesce((SELECT MIN(scheduled_at) FROM Reminders WHERE finished_at IS NULL), "STR(DAY_MAX)") "
+                                       "WHERE key = 'next_due';",
+    [STMT_NEXT_DUE_AFTER]            = "SELECT coalesce(MIN(scheduled_at), "STR(DAY_MAX)") FROM Reminders WHERE finished_at IS NULL AND scheduled_at > ?;",
+    [STMT_LOAD_CALENDAR]             = "SELECT r.scheduled_at, r.recurrence, r.repeat_until FROM Reminder_Spans s JOIN Reminders r ON r.id = s.id "
+                                       "WHERE s.first_day <= ?2 AND s.last_day >= ?1;",
+    [STMT_DATA_VERSION]              = "PRAGMA data_version;",
+    [STMT_LOAD_PENDING_REMINDERS]    = "SELECT id, scheduled_at FROM Reminders WHERE finished_at IS NULL;",
+    [STMT_LOAD_REMINDER]             = "SELECT title, scheduled_at, recurrence, repeat_until FROM Reminders WHERE id = ? AND finished_at IS NULL;",
+    [STMT_EXPORT_REMINDERS]          = "SELECT id, title, scheduled_at, recurrence, created_at, repeat_until FROM Reminders WHERE finished_at IS NULL ORDER BY scheduled_at, id;",
+    [STMT_INSERT_SPAN]               = "INSERT INTO Reminder_Spans (id, first_day, last_day) VALUES (?, ?, ?);",
+    [STMT_MOVE_SPAN]                 = "UPDATE Reminder_Spans SET first_day = ? WHERE id = ?;",
+    [STMT_DELETE_SPAN]               = "DELETE FROM Reminder_Spans WHERE id = ?;",
+    [STMT_COUNT_NOTES]               = "SELECT COUNT(*) FROM Add_Notes;",
+    [STMT_INSERT_NOTES]              = "INSERT INTO Add_Notes (notes_absolute_path_name, created_at) VALUES (?, unixepoch());",
+    [STMT_LOAD_NOTES_PATHS]          = "SELECT id, notes_absolute_path_name from Add_Notes;",
+};
+
+// Names for `trace_report`, the SQL of many statements starts the same way
+static const char *stmt_names[COUNT_STMTS] = {
+    [STMT_BEGIN_IMMEDIATE]                = "begin_immediate",
+    [STMT_COMMIT]                         = "commit",
+    [STMT_ROLLBACK]                       = "rollback",
+    [STMT_USER_VERSION]                   = "user_version",
+    [STMT_COUNT_SCHEMA_OBJECTS]           = "count_schema_objects",
+    [STMT_LOAD_ACTIVE_NOTIFICATIONS]      = "load_active_notifications",
+    [STMT_INSERT_NOTIFICATION]            = "insert_notification",
+    [STMT_DISMISS_NOTIFICATION]           = "dismiss_notification",
+    [STMT_DISMISS_NOTIFICATION_AT]        = "dismiss_notification_at",
+    [STMT_LOAD_ACTIVE_IDS]                = "load_active_ids",
+    [STMT_DISMISS_NOTIFICATIONS_IN]       = "dismiss_notifications_in",
+    [STMT_DISMISS_ALL_NOTIFICATIONS]      = "dismiss_all_notifications",
+    [STMT_DISMISS_MATCHING_NOTIFICATIONS] = "dismiss_matching_notifications",
+    [STMT_INSERT_REMINDER]                = "insert_reminder",
+    [STMT_LOAD_REMINDERS]                 = "load_reminders",
+    [STMT_COUNT_REMINDERS_BEFORE]         = "count_reminders_before",
+    [STMT_LOAD_REMINDER_IDS_BEFORE]       = "load_reminder_ids_before",
+    [STMT_LOAD_SERIES_BEFORE]             = "load_series_before",
+    [STMT_REMINDER_AT]                    = "reminder_at",
+    [STMT_FINISH_REMINDER]                = "finish_reminder",
+    [STMT_ADVANCE_REMINDER]               = "advance_reminder",
+    [STMT_GET_NEXT_DUE]                   = "get_next_due",
+    [STMT_LOWER_NEXT_DUE]                 = "lower_next_due",
+    [STMT_REFRESH_NEXT_DUE]               = "refresh_next_due",
+    [STMT_NEXT_DUE_AFTER]                 = "next_due_after",
+    [STMT_LOAD_CALENDAR]                  = "load_calendar",
+    [STMT_DATA_VERSION]                   = "data_version",
+    [STMT_LOAD_PENDING_REMINDERS]         = "load_pending_reminders",
+    [STMT_LOAD_REMINDER]                  = "load_reminder",
+    [STMT_EXPORT_REMINDERS]               = "export_reminders",
+    [STMT_INSERT_SPAN]                    = "insert_span",
+    [STMT_MOVE_SPAN]                      = "move_span",
+    [STMT_DELETE_SPAN]                    = "delete_span",
+    [STMT_COUNT_NOTES]                    = "count_notes",
+    [STMT_INSERT_NOTES]                   = "insert_notes",
+    [STMT_LOAD_NOTES_PATHS]               = "load_notes_paths",
+};
+
+static struct {
+    sqlite3 *db;
+    sqlite3_stmt *items[COUNT_STMTS];
+} stmt_cache = {0};
+
+// Returns the cached statement for `kind`, ready to be bound and stepped. Pair
+// every successful call with `release_cached` once done with the results.
+sqlite3_stmt *prepare_cached(sqlite3 *db, Stmt_Kind kind)
+{
+    assert(0 <= kind && kind < COUNT_STMTS);
+    assert((stmt_cache.db == NULL || stmt_cache.db == db) && "statement cache supports a single connection");
+    stmt_cache.db = db;
+
+    if (stmt_cache.items[kind] == NULL) {
+        int ret = sqlite3_prepare_v3(db, stmt_sql[kind], -1, SQLITE_PREPARE_PERSISTENT, &stmt_cache.items[kind], NULL);
+        if (ret != SQLITE_OK) {
+            report_sqlite_error(db);
+            return NULL;
+        }
     }
+    return stmt_cache.items[kind];
+}
 
-    return true;
+// Resets the statement so it releases its read transaction and forgets
+// bindings, which may point into memory the caller is about to free.
+void release_cached(sqlite3_stmt *stmt)
+{
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
 }
 
-typedef struct {
-    int id;
-    const char *title;
-    const char *created_at;
-} Notification;
+void finalize_stmt_cache(void)
+{
+    for (size_t i = 0; i < COUNT_STMTS; i++) {
+        if (stmt_cache.items[i]) sqlite3_finalize(stmt_cache.items[i]);
+        stmt_cache.items[i] = NULL;
+    }
+    stmt_cache.db = NULL;
+}
 
-typedef struct {
-    Notification *items;
-    size_t count;
-    size_t capacity;
-} Notifications;
+// Runs a cached statement that produces no rows
+bool exec_cached(sqlite3 *db, Stmt_Kind kind)
+{
+    sqlite3_stmt *stmt = prepare_cached(db, kind);
+    if (stmt == NULL) return false;
+
+    bool result = sqlite3_step(stmt) == SQLITE_DONE;
+    if (!result) report_sqlite_error(db);
+    release_cached(stmt);
+    return result;
+}
 
-bool load_active_notifications(sqlite3 *db, Notifications *notifs)
+// Prints the phase timings, arena counters and the sqlite counters of every
+// statement this invocation prepared. Call it before `finalize_stmt_cache`.
+void trace_report(const char *cmd)
 {
-    bool result = true;
-    sqlite3_stmt *stmt = NULL;
+    if (!trace.enabled) return;
+
+    FILE *out = stderr;
+    if (trace.output) {
+        out = fopen(trace.output, "a");
+        if (out == NULL) {
+            fprintf(stderr, "ERROR: LORE_TRACE: %s: %s\n", trace.output, strerror(errno));
+            return;
+        }
+    }
 
-    int ret = sqlite3_prepare_v2(db, "SELECT id, title, datetime(created_at, 'localtime') FROM Notifications WHERE dismissed_at IS NULL;", -1, &stmt, NULL);
-    if (ret != SQLITE_OK) {
-        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
-        return_defer(false);
+    fprintf(out, "lore trace: %s (pid %d)\n", cmd, (int)getpid());
+    for (size_t i = 0; i < trace.count; i++) {
+        fprintf(out, "  %-24s %9.3fms\n", trace.phases[i].name, trace.phases[i].ns*1e-6);
+    }
+    fprintf(out, "  %-24s %9.3fms\n", "total", (monotonic_ns() - trace.start_ns)*1e-6);
+    fprintf(out, "  arena: %zu allocations, %zu bytes, %zu mallocs\n", lore_arena.allocations, lore_arena.bytes, lore_arena.mallocs);
+
+    for (size_t i = 0; i < COUNT_STMTS; i++) {
+        sqlite3_stmt *stmt = stmt_cache.items[i];
+        if (stmt == NULL) continue;
+        fprintf(out, "  stmt %-30s runs %d, vm steps %d, fullscan steps %d, sorts %d, autoindex %d\n",
+                stmt_names[i],
+                sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_RUN, 0),
+                sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_VM_STEP, 0),
+                sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 0),
+                sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_SORT, 0),
+                sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_AUTOINDEX, 0));
     }
 
-    ret = sqlite3_step(stmt);
-    for (int index = 0; ret == SQLITE_ROW; index++) {
-        int id = sqlite3_column_int(stmt, 0);
-        const char *title = strdup((const char *)sqlite3_column_text(stmt, 1));
-        const char *created_at = strdup((const char *)sqlite3_column_text(stmt, 2));
-        da_append(notifs, ((Notification) {
-            .id = id,
-            .title = title,
-            .created_at = created_at,
-        }));
+    if (out != stderr) fclose(out);
+}
 
-        ret = sqlite3_step(stmt);
-    }
+bool query_int(sqlite3 *db, Stmt_Kind kind, int *value)
+{
+    bool result = true;
+    sqlite3_stmt *stmt = prepare_cached(db, kind);
+    if (stmt == NULL) return false;
 
-    if (ret != SQLITE_DONE) {
-        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+    if (sqlite3_step(stmt) != SQLITE_ROW) {
+        report_sqlite_error(db);
         return_defer(false);
     }
 
+    *value = sqlite3_column_int(stmt, 0);
+
 defer:
-    if (stmt) sqlite3_finalize(stmt);
+    release_cached(stmt);
     return result;
 }
 
-bool show_active_notifications(sqlite3 *db)
+// Same as `query_int` for statements taking one integer parameter
+bool query_int_arg(sqlite3 *db, Stmt_Kind kind, int arg, int *value)
 {
     bool result = true;
-    Notifications notifs = {0};
-
-    if (!load_active_notifications(db, &notifs)) return_defer(false);
+    sqlite3_stmt *stmt = prepare_cached(db, kind);
+    if (stmt == NULL) return false;
 
-    for (int i = 0; (size_t)i < notifs.count; i++) {
-        printf("%d: %s (%s)\n", i, notifs.items[i].title, notifs.items[i].created_at);
+    if (sqlite3_bind_int(stmt, 1, arg) != SQLITE_OK || sqlite3_step(stmt) != SQLITE_ROW) {
+        report_sqlite_error(db);
+        return_defer(false);
     }
 
+    *value = sqlite3_column_int(stmt, 0);
+
 defer:
-    free(notifs.items);
+    release_cached(stmt);
     return result;
 }
 
-bool create_notification_with_title(sqlite3 *db, const char *title)
+// Brings the schema up to LORE_SCHEMA_VERSION. An up to date database costs a
+// single `PRAGMA user_version` read, which sqlite answers from the file header.
+// `created` is set when the database was empty before migrating, which replaces
+// the old `File_Creation` row counting for the first run message.
+bool migrate_schema(sqlite3 *db, bool *created)
 {
     bool result = true;
-    sqlite3_stmt *stmt = NULL;
-    if (sqlite3_prepare_v2(db, "INSERT INTO Notifications (title) VALUES (?)", -1, &stmt, NULL) != SQLITE_OK) {
-        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+    bool in_transaction = false;
+    int version = 0;
+
+    *created = false;
+    if (!query_int(db, STMT_USER_VERSION, &version)) return false;
+    if (version == LORE_SCHEMA_VERSION) return true;
+    // Only a pending migration is worth the write lock
+    if (version > LORE_SCHEMA_VERSION) {
+        fprintf(stderr, "ERROR: database schema version %d is newer than this lore (%d)\n", version, LORE_SCHEMA_VERSION);
+        return false;
+    }
+
+    for (int pending = version; pending < LORE_SCHEMA_VERSION; pending++) {
+        if (migrations[pending].before_transaction && !migrations[pending].before_transaction(db)) return false;
+    }
+
+    if (!exec_cached(db, STMT_BEGIN_IMMEDIATE)) return_defer(false);
+    in_transaction = true;
+
+    // Another lore process might have migrated while we were waiting for the lock
+    if (!query_int(db, STMT_USER_VERSION, &version)) return_defer(false);
+    if (version == LORE_SCHEMA_VERSION) return_defer(true);
+    if (version > LORE_SCHEMA_VERSION) {
+        fprintf(stderr, "ERROR: database schema version %d is newer than this lore (%d)\n", version, LORE_SCHEMA_VERSION);
         return_defer(false);
     }
 
-    if (sqlite3_bind_text(stmt, 1, title, strlen(title), NULL) != SQLITE_OK) {
+    int object_count = 0;
+    if (!query_int(db, STMT_COUNT_SCHEMA_OBJECTS, &object_count)) return_defer(false);
+
+    if (sqlite3_create_function(db, "lore_day", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, sql_lore_day, NULL, NULL) != SQLITE_OK) {
         fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
         return_defer(false);
     }
 
-    if (sqlite3_step(stmt) != SQLITE_DONE) {
+    for (; version < LORE_SCHEMA_VERSION; version++) {
+        if (migrations[version].sql == NULL) continue;
+        if (sqlite3_exec(db, migrations[version].sql, NULL, NULL, NULL) != SQLITE_OK) {
+            fprintf(stderr, "SQLITE3 ERROR: migration %d -> %d: %s\n", version, version + 1, sqlite3_errmsg(db));
+            return_defer(false);
+        }
+    }
+
+    char sql[64];
+    snprintf(sql, sizeof(sql), "PRAGMA user_version = %d;", LORE_SCHEMA_VERSION);
+    if (sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK) {
         fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
         return_defer(false);
     }
+    if (!exec_cached(db, STMT_COMMIT)) return_defer(false);
+    in_transaction = false;
+    *created = object_count == 0;
 
 defer:
-    if (stmt) sqlite3_finalize(stmt);
+    if (in_transaction) exec_cached(db, STMT_ROLLBACK);
     return result;
 }
 
-bool dismiss_notification_by_id(sqlite3 *db, int id)
-{
-    bool result = true;
-    sqlite3_stmt *stmt = NULL;
+// ** Latency budget **
 
-    int ret = sqlite3_prepare_v2(db, "UPDATE Notifications SET dismissed_at = CURRENT_TIMESTAMP WHERE id = ?", -1, &stmt, NULL);
-    if (ret != SQLITE_OK) {
-        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
-        return_defer(false);
-    }
-    
-    if (sqlite3_bind_int(stmt, 1, id) != SQLITE_OK) {
-        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
-        return_defer(false);
+// `checkout` runs from the shell startup hook and must not hang it on a locked
+// database or a slow disk. Past `deadline_ns` the busy handler stops retrying
+// and the progress handler interrupts the running statement.
+#define CHECKOUT_BUDGET_MS_DEFAULT 20
+#define SNAPSHOT_REFRESH_BUDGET_MS (60*1000)
+#define BUDGET_PROGRESS_OPS 1000
+#define BUDGET_BUSY_SLEEP_US 1000
+
+static int budget_busy_handler(void *arg, int count)
+{
+    Budget *budget = arg;
+    (void) count;
+    if (monotonic_ns() >= budget->deadline_ns) {
+        budget->exceeded = true;
+        return 0;
     }
+    usleep(BUDGET_BUSY_SLEEP_US);
+    return 1;
+}
 
-    if (sqlite3_step(stmt) != SQLITE_DONE) {
-        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
-        return_defer(false);
+static int budget_progress_handler(void *arg)
+{
+    Budget *budget = arg;
+    if (monotonic_ns() < budget->deadline_ns) return 0;
+    budget->exceeded = true;
+    return 1;
+}
+
+// Starts the clock on `ms` milliseconds, 0 means no budget
+void budget_start(Budget *budget, int ms)
+{
+    budget->deadline_ns = ms > 0 ? monotonic_ns() + (uint64_t)ms*1000000 : 0;
+    budget->exceeded = false;
+}
+
+// Everything but checkout waits for locks with exponential backoff: 1 ms
+// doubling up to BUSY_BACKOFF_MAX_MS, with jitter so a burst of writers does
+// not retry in lockstep, until a single wait took BUSY_TIMEOUT_MS.
+#define BUSY_BACKOFF_MAX_MS 64
+#define BUSY_TIMEOUT_MS 5000
+
+static int busy_backoff_handler(void *arg, int count)
+{
+    uint64_t *wait_start = arg;
+    uint64_t now = monotonic_ns();
+    if (count == 0) *wait_start = now;
+    else if (now - *wait_start >= (uint64_t)BUSY_TIMEOUT_MS*1000000) return 0;
+
+    int delay_us = (count < 6 ? 1 << count : BUSY_BACKOFF_MAX_MS)*1000;
+    usleep(delay_us/2 + rand()%(delay_us/2 + 1));
+    return 1;
+}
+
+static void install_busy_handler(sqlite3 *db, Budget *budget)
+{
+    static uint64_t wait_start = 0;
+    static bool seeded = false;
+    // Unseeded, every process would draw the same jitter and writers started
+    // together would still retry in lockstep
+    if (!seeded) {
+        srand((unsigned)(getpid() ^ monotonic_ns()));
+        seeded = true;
+    }
+    if (budget) sqlite3_busy_handler(db, budget_busy_handler, budget);
+    else sqlite3_busy_handler(db, busy_backoff_handler, &wait_start);
+}
+
+// LORE_CHECKOUT_BUDGET_MS or CHECKOUT_BUDGET_MS_DEFAULT
+int checkout_budget_ms(void)
+{
+    const char *env = getenv("LORE_CHECKOUT_BUDGET_MS");
+    if (env != NULL && isdigit((unsigned char)*env)) return atoi(env);
+    return CHECKOUT_BUDGET_MS_DEFAULT;
+}
+
+// Opens the database for a command. Display commands pass `read_only` and get
+// a SQLITE_OPEN_READONLY connection when the file exists and is already on the
+// current schema, so they never take a write lock, run DDL or do first run
+// bookkeeping. Everything else, including a first run or a pending migration,
+// goes through the read-write open and `migrate_schema`. Lock waits stop at the
+// deadline of `budget`, if there is one, and back off otherwise.
+//
+// Databases are kept in WAL mode, so readers and the one writer do not block
+// each other. Connections leave the -wal file in place when they close rather
+// than checkpointing it, which would change the database file behind the
+// checkout snapshot after every write; sqlite checkpoints on commit instead
+// once the -wal file grew large.
+bool open_database(const char *path, bool read_only, Budget *budget, sqlite3 **db, bool *created)
+{
+    *created = false;
+
+    if (read_only) {
+        int version = -1;
+        int ret = sqlite3_open_v2(path, db, SQLITE_OPEN_READONLY, NULL);
+        if (ret == SQLITE_OK) install_busy_handler(*db, budget);
+        if (ret == SQLITE_OK && query_int(*db, STMT_USER_VERSION, &version) && version == LORE_SCHEMA_VERSION) {
+            trace_phase("sqlite3_open read-only");
+            return true;
+        }
+        finalize_stmt_cache();
+        sqlite3_close(*db);
+        *db = NULL;
+        // Locked rather than outdated, the read-write open would not fare better
+        if (budget && budget->exceeded) return false;
+    }
+
+    int ret = sqlite3_open(path, db);
+    if (ret != SQLITE_OK) {
+        fprintf(stderr, "ERROR: %s: %s\n", path, sqlite3_errstr(ret));
+        return false;
+    }
+    install_busy_handler(*db, budget);
+    if (sqlite3_db_config(*db, SQLITE_DBCONFIG_NO_CKPT_ON_CLOSE, 1, NULL) != SQLITE_OK) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(*db));
+        return false;
+    }
+    trace_phase("sqlite3_open");
+
+    if (!migrate_schema(*db, created)) return false;
+    trace_phase("migrate_schema");
+    return true;
+}
+
+bool write_all(int fd, const char *buf, size_t n)
+{
+    while (n > 0) {
+        ssize_t written = write(fd, buf, n);
+        if (written < 0) return false;
+        buf += written;
+        n -= written;
+    }
+    return true;
+}
+
+// Writes all of `iov`, picking up where a short write stopped
+static bool writev_all(int fd, struct iovec *iov, int count)
+{
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, count);
+        if (written < 0) return false;
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+// ** Output **
+
+// Everything lore prints for the user is formatted into `sb` and leaves in as
+// few syscalls as possible: one write(2) when it fits a single chunk, one
+// writev(2) over the filled chunks otherwise. Chunks of RENDER_FLUSH_THRESHOLD
+// bytes are never copied into a bigger buffer, and at most OUTPUT_CHUNKS of
+// them are held, so memory stays bounded however many rows are rendered. A
+// render that fails before filling them has written nothing.
+typedef struct {
+    int fd;
+    String_Builder sb;                          // chunk being filled
+    String_Builder full[OUTPUT_CHUNKS - 1];     // waiting for the writev
+    size_t full_count;
+    bool flushed;   // some of the output was written already
+    bool tee;       // `tee_fd` gets a copy, cleared when writing the copy failed
+    int tee_fd;
+} Output;
+
+// Drops the buffered output, the buffers are kept for reuse
+void out_discard(Output *out)
+{
+    for (size_t i = 0; i < out->full_count; i++) out->full[i].count = 0;
+    out->full_count = 0;
+    out->sb.count = 0;
+}
+
+bool out_flush(Output *out)
+{
+    bool result = true;
+    struct iovec iov[OUTPUT_CHUNKS], tee_iov[OUTPUT_CHUNKS];
+    int count = 0;
+    for (size_t i = 0; i < out->full_count; i++) {
+        iov[count++] = (struct iovec) { .iov_base = out->full[i].items, .iov_len = out->full[i].count };
+    }
+    iov[count++] = (struct iovec) { .iov_base = out->sb.items, .iov_len = out->sb.count };
+    // `writev_all` advances through the vector it is given
+    if (out->tee) memcpy(tee_iov, iov, count*sizeof(*iov));
+
+    if (count == 1) result = write_all(out->fd, out->sb.items, out->sb.count);
+    else result = writev_all(out->fd, iov, count);
+    if (out->tee && !writev_all(out->tee_fd, tee_iov, count)) out->tee = false;
+    out->flushed = true;
+    out_discard(out);
+    return result;
+}
+
+// Called after every rendered row. Sets the current chunk aside once it is
+// full and writes everything out when no chunk is left.
+bool out_end_row(Output *out)
+{
+    if (out->sb.count < RENDER_FLUSH_THRESHOLD) return true;
+    if (out->full_count == OUTPUT_CHUNKS - 1) return out_flush(out);
+
+    String_Builder spare = out->full[out->full_count];
+    out->full[out->full_count++] = out->sb;
+    out->sb = spare;
+    // Sized up front, growing it by doubling would copy and leave the old
+    // copies behind in the arena
+    if (out->sb.capacity == 0) sb_reserve(&out->sb, 2*RENDER_FLUSH_THRESHOLD);
+    return true;
+}
+
+// Formats the active notifications straight out of the result rows into `out`
+bool render_active_notifications(sqlite3 *db, Output *out)
+{
+    bool result = true;
+    sqlite3_stmt *stmt = prepare_cached(db, STMT_LOAD_ACTIVE_NOTIFICATIONS);
+    if (stmt == NULL) return false;
+
+    int ret = sqlite3_step(stmt);
+    for (int index = 0; ret == SQLITE_ROW; index++) {
+        char created_at[TIMESTAMP_SIZE];
+        format_local_timestamp(sqlite3_column_int64(stmt, 2), created_at);
+        sb_appendf(&out->sb, "%d: ", index);
+        sb_append_buf(&out->sb, (const char *)sqlite3_column_text(stmt, 1), sqlite3_column_bytes(stmt, 1));
+        sb_append_cstr(&out->sb, " (");
+        sb_append_buf(&out->sb, created_at, TIMESTAMP_SIZE - 1);
+        sb_append_cstr(&out->sb, ")\n");
+
+        if (!out_end_row(out)) return_defer(false);
+        ret = sqlite3_step(stmt);
+    }
+    trace_phase("render notifications");
+
+    if (ret != SQLITE_DONE) {
+        report_sqlite_error(db);
+        return_defer(false);
+    }
+
+defer:
+    release_cached(stmt);
+    return result;
+}
+
+// A recurring reminder scheduled before a listing window that has an
+// occurrence inside of it
+typedef struct {
+    int64_t id;
+    int scheduled;
+    int day;            // first occurrence inside the window
+    int index;          // position in the unfiltered listing
+    const char *title;
+    const char *period;
+} Series_Occurrence;
+
+typedef struct {
+    Series_Occurrence *items;
+    size_t count;
+    size_t capacity;
+} Series_Occurrences;
+
+bool load_series_occurrences(sqlite3 *db, int from, int to, Series_Occurrences *series, int *before);
+
+static void append_reminder_row(String_Builder *sb, int index, const char *title, int title_len, int day, const char *period, int period_len)
+{
+    char date[DATE_SIZE];
+    day_to_date(day, date);
+    sb_appendf(sb, "%d: ", index);
+    sb_append_buf(sb, title, title_len);
+    sb_append_cstr(sb, " (");
+    sb_append_cstr(sb, date);
+    if (period) {
+        sb_append_cstr(sb, ", ");
+        sb_append_buf(sb, period, period_len);
+    }
+    sb_append_cstr(sb, ")\n");
+}
+
+// Same as `render_active_notifications` for unfinished reminders scheduled
+// within [from, to]. The range is one contiguous run of the Reminders_Due
+// index, so positions continue from the number of reminders before `from`
+// and match the ones of the unfiltered listing. Recurring reminders scheduled
+// before `from` are listed at their first occurrence in the window, merged in
+// by date. `header` is printed before the first row, if there is one.
+bool render_reminders(sqlite3 *db, Output *out, int from, int to, const char *header)
+{
+    bool result = true;
+    int index = 0;
+    Series_Occurrences series = {0};
+    size_t next = 0;
+    sqlite3_stmt *stmt = NULL;
+
+    if (from > DAY_MIN && !load_series_occurrences(db, from, to, &series, &index)) return false;
+
+    stmt = prepare_cached(db, STMT_LOAD_REMINDERS);
+    if (stmt == NULL) return_defer(false);
+
+    if (sqlite3_bind_int(stmt, 1, from) != SQLITE_OK || sqlite3_bind_int(stmt, 2, to) != SQLITE_OK) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+
+    int ret = sqlite3_step(stmt);
+    if ((ret == SQLITE_ROW || series.count > 0) && header) sb_append_cstr(&out->sb, header);
+    for (;;) {
+        // Series go first on the same day, they were scheduled earlier
+        if (next < series.count && (ret != SQLITE_ROW || series.items[next].day <= sqlite3_column_int(stmt, 1))) {
+            const Series_Occurrence *item = &series.items[next++];
+            append_reminder_row(&out->sb, item->index, item->title, strlen(item->title), item->day,
+                                item->period, item->period ? strlen(item->period) : 0);
+        } else if (ret == SQLITE_ROW) {
+            append_reminder_row(&out->sb, index++,
+                                (const char *)sqlite3_column_text(stmt, 0), sqlite3_column_bytes(stmt, 0),
+                                sqlite3_column_int(stmt, 1),
+                                (const char *)sqlite3_column_text(stmt, 2), sqlite3_column_bytes(stmt, 2));
+            ret = sqlite3_step(stmt);
+        } else {
+            break;
+        }
+
+        if (!out_end_row(out)) return_defer(false);
+    }
+    trace_phase("render reminders");
+
+    if (ret != SQLITE_DONE) {
+        report_sqlite_error(db);
+        return_defer(false);
+    }
+
+defer:
+    if (stmt) release_cached(stmt);
+    return result;
+}
+
+// The part of `lore checkout` after the notifications: the reminders that are
+// due `today` or overdue. The reminder index is only touched when the next due
+// watermark says something is due. `valid_until` receives the first day on
+// which the checkout output would change without any write.
+bool render_checkout_reminders(sqlite3 *db, Output *out, int today, int *valid_until)
+{
+    if (!query_int(db, STMT_GET_NEXT_DUE, valid_until)) return false;
+    if (today >= *valid_until) {
+        if (!render_reminders(db, out, DAY_MIN, today, "Reminders:\n")) return false;
+        if (!query_int_arg(db, STMT_NEXT_DUE_AFTER, today, valid_until)) return false;
+    }
+    return true;
+}
+
+// Everything `lore checkout` prints: the active notifications followed by the
+// due reminders, see `render_checkout_reminders`
+bool render_checkout(sqlite3 *db, Output *out, int today, int *valid_until)
+{
+    if (!render_active_notifications(db, out)) return false;
+    if (!render_checkout_reminders(db, out, today, valid_until)) return false;
+
+    if (!out_flush(out)) return false;
+    trace_phase("render write");
+    return true;
+}
+
+bool show_active_reminders(sqlite3 *db, int from, int to)
+{
+    Output out = { .fd = STDOUT_FILENO };
+    if (!render_reminders(db, &out, from, to, NULL)) return false;
+    if (!out_flush(&out)) return false;
+    trace_phase("render write");
+    return true;
+}
+
+// The checkout snapshot is the rendered output of `show_checkout` stored next
+// to the database, so the shell hook can print it without opening sqlite. It
+// is valid as long as the database file and its -wal file still have the
+// identity they had while the snapshot was rendered, no other reminder has
+// become due since and the local UTC offset the timestamps were formatted with
+// is still the same. Every lore write renders a new snapshot once it committed,
+// the identity check is there for writes whose snapshot could not be written.
+#define SNAPSHOT_MAGIC "LORESNAP"
+#define SNAPSHOT_VERSION 7
+
+typedef struct {
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+} File_Identity;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t length;        // bytes of rendered output following the header
+    File_Identity db;
+    File_Identity wal;      // commits not checkpointed into `db` yet, zeroes without one
+    int32_t rendered_on;    // day number
+    int32_t valid_until;    // day number, exclusive
+    int32_t utc_offset;     // of the rendered timestamps
+    int32_t padding;
+} Snapshot_Header;
+
+// Identity of the database at `db_path` and of its -wal file, which in WAL
+// mode is the only file a commit touches
+static bool db_identity(const char *db_path, File_Identity *db, File_Identity *wal)
+{
+    char wal_path[PATH_MAX];
+    struct stat st;
+
+    if (stat(db_path, &st) < 0) return false;
+    *db = (File_Identity) { st.st_ino, st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec };
+
+    int n = snprintf(wal_path, sizeof(wal_path), "%s-wal", db_path);
+    if (n < 0 || (size_t)n >= sizeof(wal_path)) return false;
+    *wal = (File_Identity) {0};
+    if (stat(wal_path, &st) == 0) *wal = (File_Identity) { st.st_ino, st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec };
+    return true;
+}
+
+static bool same_db_identity(const Snapshot_Header *header, const File_Identity *db, const File_Identity *wal)
+{
+    return memcmp(&header->db, db, sizeof(*db)) == 0 && memcmp(&header->wal, wal, sizeof(*wal)) == 0;
+}
+
+static bool snapshot_path_of(const char *db_path, char *path, size_t path_sz)
+{
+    int n = snprintf(path, path_sz, "%s"SNAPSHOT_SUFFIX, db_path);
+    return n >= 0 && (size_t)n < path_sz;
+}
+
+// Prints a valid snapshot and returns true, or returns false without printing
+// anything if the snapshot is missing or stale. With `stale` any snapshot
+// rendered for this database is printed, below a line that says so.
+bool checkout_from_snapshot(const char *lore_path, bool stale)
+{
+    bool result = true;
+    char path[PATH_MAX];
+    struct stat snap_st;
+    File_Identity db_id, wal_id;
+    int fd = -1;
+    void *data = MAP_FAILED;
+
+    if (!snapshot_path_of(lore_path, path, sizeof(path))) return false;
+    if (!db_identity(lore_path, &db_id, &wal_id)) return false;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    if (fstat(fd, &snap_st) < 0 || (size_t)snap_st.st_size < sizeof(Snapshot_Header)) return_defer(false);
+
+    data = mmap(NULL, snap_st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) return_defer(false);
+
+    int today = local_today();
+
+    const Snapshot_Header *header = data;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != SNAPSHOT_VERSION ||
+            sizeof(*header) + header->length != (size_t)snap_st.st_size) {
+        return_defer(false);
+    }
+    if (!stale && (!same_db_identity(header, &db_id, &wal_id) ||
+            header->rendered_on > today || today >= header->valid_until ||
+            header->utc_offset != local_offset_at(time(NULL)))) {
+        return_defer(false);
+    }
+
+    char note[128] = {0};
+    if (stale) {
+        char date[DATE_SIZE];
+        day_to_date(header->rendered_on, date);
+        snprintf(note, sizeof(note), "(stale: lore could not read its database in time, showing the output of %s)\n", date);
+    }
+    struct iovec iov[] = {
+        { .iov_base = note, .iov_len = strlen(note) },
+        { .iov_base = (char *)data + sizeof(*header), .iov_len = header->length },
+    };
+    if (!writev_all(STDOUT_FILENO, iov, 2)) return_defer(false);
+
+defer:
+    if (data != MAP_FAILED) munmap(data, snap_st.st_size);
+    if (fd >= 0) close(fd);
+    return result;
+}
+
+// A snapshot being written, it only replaces the current one once complete
+typedef struct {
+    const char *db_path;
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    File_Identity db;       // before rendering
+    File_Identity wal;
+    int fd;                 // rendered output goes here, the header is filled in last
+} Snapshot_File;
+
+static void snapshot_abort(Snapshot_File *snap)
+{
+    if (snap->fd >= 0) close(snap->fd);
+    snap->fd = -1;
+    unlink(snap->tmp_path);
+}
+
+static bool snapshot_begin(const char *db_path, Snapshot_File *snap)
+{
+    snap->fd = -1;
+    snap->db_path = db_path;
+    if (db_path == NULL || !snapshot_path_of(db_path, snap->path, sizeof(snap->path))) return false;
+    int n = snprintf(snap->tmp_path, sizeof(snap->tmp_path), "%s.%d", snap->path, (int)getpid());
+    if (n < 0 || (size_t)n >= sizeof(snap->tmp_path)) return false;
+    if (!db_identity(db_path, &snap->db, &snap->wal)) return false;
+
+    snap->fd = open(snap->tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (snap->fd < 0) return false;
+    if (lseek(snap->fd, sizeof(Snapshot_Header), SEEK_SET) < 0) {
+        snapshot_abort(snap);
+        return false;
+    }
+    return true;
+}
+
+// Moves the snapshot in place, unless somebody wrote to the database while it
+// was being rendered
+static bool snapshot_commit(Snapshot_File *snap, int rendered_on, int valid_until)
+{
+    bool result = true;
+    Snapshot_Header header = {0};
+    File_Identity db_after, wal_after;
+
+    off_t end = lseek(snap->fd, 0, SEEK_CUR);
+    if (end < 0) return_defer(false);
+
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.length = (uint32_t)(end - sizeof(header));
+    header.db = snap->db;
+    header.wal = snap->wal;
+    header.rendered_on = rendered_on;
+    header.valid_until = valid_until;
+    header.utc_offset = (int32_t)local_offset_at(time(NULL));
+
+    if (!db_identity(snap->db_path, &db_after, &wal_after) || !same_db_identity(&header, &db_after, &wal_after)) return_defer(false);
+
+    if (pwrite(snap->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) return_defer(false);
+    int ret = close(snap->fd);
+    snap->fd = -1;
+    if (ret != 0 || rename(snap->tmp_path, snap->path) < 0) return_defer(false);
+
+defer:
+    if (!result) snapshot_abort(snap);
+    return result;
+}
+
+// Regenerates the snapshot from the current database state. Callers are free to
+// ignore failures here, the next checkout just takes the slow path.
+bool write_checkout_snapshot(sqlite3 *db)
+{
+    Snapshot_File snap;
+    if (!snapshot_begin(sqlite3_db_filename(db, "main"), &snap)) return false;
+
+    Output out = { .fd = snap.fd };
+    int today = local_today(), valid_until = 0;
+    if (!render_checkout(db, &out, today, &valid_until)) {
+        snapshot_abort(&snap);
+        return false;
+    }
+    return snapshot_commit(&snap, today, valid_until);
+}
+
+// Prints the checkout output and stores the very same bytes as the new
+// snapshot, from a single render. `partial` is set when the render failed
+// after some of the output was written already.
+bool show_checkout(sqlite3 *db, bool *partial)
+{
+    Snapshot_File snap;
+    bool snapshot = snapshot_begin(sqlite3_db_filename(db, "main"), &snap);
+    Output out = { .fd = STDOUT_FILENO, .tee = snapshot, .tee_fd = snap.fd };
+    int today = local_today(), valid_until = 0;
+
+    bool result = render_checkout(db, &out, today, &valid_until);
+    *partial = !result && out.flushed;
+    if (result && out.tee) snapshot_commit(&snap, today, valid_until);
+    else if (snapshot) snapshot_abort(&snap);
+    trace_phase("write snapshot");
+    return result;
+}
+
+bool begin_write(sqlite3 *db)
+{
+    return exec_cached(db, STMT_BEGIN_IMMEDIATE);
+}
+
+// Commits a write started with `begin_write`
+bool commit_write(sqlite3 *db)
+{
+    return exec_cached(db, STMT_COMMIT);
+}
+
+// Commits a write started with `begin_write` and refreshes the checkout snapshot.
+bool end_write(sqlite3 *db)
+{
+    if (!commit_write(db)) return false;
+    trace_phase("commit");
+    write_checkout_snapshot(db);
+    trace_phase("write snapshot");
+    return true;
+}
+
+// `end_write` for the commands that print the active notifications afterwards.
+// Those are the start of the checkout output, so they are rendered once for
+// both stdout and the snapshot, which then gets the due reminders on its own.
+bool end_write_and_show_notifications(sqlite3 *db)
+{
+    if (!commit_write(db)) return false;
+    trace_phase("commit");
+
+    Snapshot_File snap;
+    bool snapshot = snapshot_begin(sqlite3_db_filename(db, "main"), &snap);
+    Output out = { .fd = STDOUT_FILENO, .tee = snapshot, .tee_fd = snap.fd };
+    if (!render_active_notifications(db, &out) || !out_flush(&out)) {
+        if (snapshot) snapshot_abort(&snap);
+        return false;
+    }
+    trace_phase("render write");
+
+    if (out.tee) {
+        int today = local_today(), valid_until = 0;
+        out.fd = snap.fd;
+        out.tee = false;
+        if (render_checkout_reminders(db, &out, today, &valid_until) && out_flush(&out)) {
+            snapshot_commit(&snap, today, valid_until);
+        } else {
+            snapshot_abort(&snap);
+        }
+    } else if (snapshot) {
+        snapshot_abort(&snap);
+    }
+    trace_phase("write snapshot");
+    return true;
+}
+
+bool create_notification_with_title(sqlite3 *db, const char *title)
+{
+    bool result = true;
+    sqlite3_stmt *stmt = prepare_cached(db, STMT_INSERT_NOTIFICATION);
+    if (stmt == NULL) return_defer(false);
+
+    if (sqlite3_bind_text(stmt, 1, title, strlen(title), NULL) != SQLITE_OK) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+
+defer:
+    if (stmt) release_cached(stmt);
+    return result;
+}
+
+// Inserts one notification per `delim` terminated record of `in`, committing
+// every `batch_size` rows. Blank records are skipped. The checkout snapshot is
+// refreshed once at the end rather than per batch.
+bool import_notifications(sqlite3 *db, FILE *in, char delim, size_t batch_size, size_t *imported)
+{
+    bool result = true;
+    char *line = NULL;
+    size_t line_cap = 0;
+    size_t pending = 0;
+
+    if (!begin_write(db)) return_defer(false);
+
+    ssize_t n;
+    while ((n = getdelim(&line, &line_cap, delim, in)) >= 0) {
+        while (n > 0 && (line[n - 1] == delim || line[n - 1] == '\r')) line[--n] = '\0';
+        if (n == 0) continue;
+
+        if (!create_notification_with_title(db, line)) return_defer(false);
+        *imported += 1;
+
+        if (++pending >= batch_size) {
+            if (!commit_write(db) || !begin_write(db)) return_defer(false);
+            pending = 0;
+        }
+    }
+
+    if (ferror(in)) {
+        fprintf(stderr, "ERROR: could not read notifications: %s\n", strerror(errno));
+        return_defer(false);
+    }
+
+    if (!end_write(db)) return_defer(false);
+
+defer:
+    free(line);
+    return result;
+}
+
+bool dismiss_notification_by_id(sqlite3 *db, int id)
+{
+    bool result = true;
+    sqlite3_stmt *stmt = NULL;
+
+    stmt = prepare_cached(db, STMT_DISMISS_NOTIFICATION);
+    if (stmt == NULL) return_defer(false);
+
+    if (sqlite3_bind_int(stmt, 1, id) != SQLITE_OK) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+
+defer:
+    if (stmt) release_cached(stmt);
+    return result;
+}
+
+// Resolves the display position inside sqlite: the OFFSET walks the active
+// partial index without materializing any rows, then a single UPDATE by id.
+bool dismiss_notification_by_index(sqlite3 *db, int index)
+{
+    bool result = true;
+    sqlite3_stmt *stmt = NULL;
+
+    if (index < 0) {
+        fprintf(stderr, "ERROR: %d is not a valid index of an active notification.\n", index);
+        return_defer(false);
+    }
+
+    stmt = prepare_cached(db, STMT_DISMISS_NOTIFICATION_AT);
+    if (stmt == NULL) return_defer(false);
+
+    if (sqlite3_bind_int(stmt, 1, index) != SQLITE_OK) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+
+    if (sqlite3_changes(db) != 1) {
+        fprintf(stderr, "ERROR: %d is not a valid index of an active notification.\n", index);
+        return_defer(false);
+    }
+
+defer:
+    if (stmt) release_cached(stmt);
+    return result;
+}
+
+typedef struct {
+    int lo;
+    int hi;     // INDEX_RANGE_OPEN for `lo-`
+} Index_Range;
+
+#define INDEX_RANGE_OPEN INT_MAX
+
+typedef struct {
+    Index_Range *items;
+    size_t count;
+    size_t capacity;
+} Index_Ranges;
+
+static bool parse_index(const char **s, int *value)
+{
+    if (!isdigit((unsigned char)**s)) return false;
+    long n = 0;
+    while (isdigit((unsigned char)**s)) {
+        n = n*10 + (**s - '0');
+        if (n >= INDEX_RANGE_OPEN) return false;
+        (*s)++;
+    }
+    *value = (int)n;
+    return true;
+}
+
+// Parses `1-20,25,30-` style lists of display positions
+bool parse_index_ranges(const char *spec, Index_Ranges *ranges)
+{
+    const char *s = spec;
+    for (;;) {
+        Index_Range range = {0};
+        if (!parse_index(&s, &range.lo)) return false;
+        range.hi = range.lo;
+        if (*s == '-') {
+            s++;
+            if (*s == ',' || *s == '\0') range.hi = INDEX_RANGE_OPEN;
+            else if (!parse_index(&s, &range.hi) || range.hi < range.lo) return false;
+        }
+        da_append(ranges, range);
+
+        if (*s == '\0') return true;
+        if (*s != ',') return false;
+        s++;
+    }
+}
+
+static int compare_index_ranges(const void *a, const void *b)
+{
+    const Index_Range *ra = a, *rb = b;
+    return (ra->lo > rb->lo) - (ra->lo < rb->lo);
+}
+
+// Maps every position to its id while walking one ordered scan of the active
+// index, then dismisses all of them with a single UPDATE. Run it inside the
+// write transaction so positions and the update see the same rows.
+bool dismiss_notifications_in_ranges(sqlite3 *db, Index_Ranges ranges)
+{
+    bool result = true;
+    String_Builder ids = {0};
+    sqlite3_stmt *stmt = NULL;
+
+    qsort(ranges.items, ranges.count, sizeof(*ranges.items), compare_index_ranges);
+
+    stmt = prepare_cached(db, STMT_LOAD_ACTIVE_IDS);
+    if (stmt == NULL) return_defer(false);
+
+    sb_append_cstr(&ids, "[");
+    size_t r = 0;
+    int index = 0;
+    int ret = sqlite3_step(stmt);
+    for (; ret == SQLITE_ROW && r < ranges.count; index++) {
+        while (r < ranges.count && index > ranges.items[r].hi) r++;
+        if (r < ranges.count && index >= ranges.items[r].lo) {
+            char id[32];
+            int n = snprintf(id, sizeof(id), "%s%lld", ids.count > 1 ? "," : "", sqlite3_column_int64(stmt, 0));
+            sb_append_buf(&ids, id, n);
+        }
+        ret = sqlite3_step(stmt);
+    }
+    if (ret != SQLITE_ROW && ret != SQLITE_DONE) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+    release_cached(stmt);
+    stmt = NULL;
+    sb_append_cstr(&ids, "]");
+
+    // `index` is the number of active notifications unless the scan stopped early
+    for (size_t i = 0; i < ranges.count; i++) {
+        int last = ranges.items[i].hi == INDEX_RANGE_OPEN ? ranges.items[i].lo : ranges.items[i].hi;
+        if (ret == SQLITE_DONE && last >= index) {
+            fprintf(stderr, "ERROR: %d is not a valid index of an active notification.\n", last);
+            return_defer(false);
+        }
+    }
+
+    stmt = prepare_cached(db, STMT_DISMISS_NOTIFICATIONS_IN);
+    if (stmt == NULL) return_defer(false);
+
+    if (sqlite3_bind_text(stmt, 1, ids.items, ids.count, NULL) != SQLITE_OK) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+
+defer:
+    if (stmt) release_cached(stmt);
+    return result;
+}
+
+bool dismiss_notifications_matching(sqlite3 *db, const char *text)
+{
+    bool result = true;
+    sqlite3_stmt *stmt = prepare_cached(db, STMT_DISMISS_MATCHING_NOTIFICATIONS);
+    if (stmt == NULL) return false;
+
+    if (sqlite3_bind_text(stmt, 1, text, strlen(text), NULL) != SQLITE_OK) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+
+defer:
+    release_cached(stmt);
+    return result;
+}
+
+// ** Recurring reminders **
+
+typedef enum {
+    RECUR_NONE = 0,
+    RECUR_DAILY,
+    RECUR_WEEKLY,
+    RECUR_MONTHLY,
+    RECUR_YEARLY,
+} Recur_Kind;
+
+typedef struct {
+    Recur_Kind kind;
+    int interval;  // every `interval` days/weeks/months/years
+    int weekdays;  // RECUR_WEEKLY: bit 0 is Sunday, bit 6 is Saturday
+    int month_day; // RECUR_MONTHLY and RECUR_YEARLY: clamped to the length of the month
+    int month;     // RECUR_YEARLY
+    int until;     // last day an occurrence may fall on, 0 when open ended. Kept in
+                   // Reminders.repeat_until rather than in the packed form.
+} Recurrence;
+
+#define RECUR_MAX_INTERVAL 4095
+
+// Stored in Reminders.recurrence as kind:3 interval:12 weekdays:7 month_day:5 month:4
+int64_t recurrence_encode(Recurrence r)
+{
+    return (int64_t)r.kind | (int64_t)r.interval << 3 | (int64_t)r.weekdays << 15 |
+           (int64_t)r.month_day << 22 | (int64_t)r.month << 27;
+}
+
+Recurrence recurrence_decode(int64_t value)
+{
+    return (Recurrence) {
+        .kind      = value & 0x7,
+        .interval  = (value >> 3) & 0xfff,
+        .weekdays  = (value >> 15) & 0x7f,
+        .month_day = (value >> 22) & 0x1f,
+        .month     = (value >> 27) & 0xf,
+    };
+}
+
+// Month index counts months since year 0 so monthly steps are additions
+static int month_index_day(int month_index, int month_day)
+{
+    int y = month_index/12, m = month_index%12 + 1;
+    int d = month_day < days_in_month(y, m) ? month_day : days_in_month(y, m);
+    return days_from_civil(y, m, d);
+}
+
+// First occurrence on or after `day` of the series starting at `anchor`.
+// `anchor` decides which weeks, months or years are part of an "every N" series.
+int recurrence_on_or_after(Recurrence r, int anchor, int day)
+{
+    if (day < anchor) day = anchor;
+    int y, m, d, ay, am, ad;
+    civil_from_days(anchor, &ay, &am, &ad);
+    civil_from_days(day, &y, &m, &d);
+
+    switch (r.kind) {
+    case RECUR_DAILY: {
+        int steps = (day - anchor + r.interval - 1)/r.interval;
+        return anchor + steps*r.interval;
+    }
+    case RECUR_WEEKLY: {
+        int base = anchor - weekday_of(anchor); // Sunday of the anchor week
+        int week = (day - base)/7;
+        if (week%r.interval == 0) {
+            for (int wd = weekday_of(day); wd < 7; wd++) {
+                if (r.weekdays & (1 << wd)) return base + week*7 + wd;
+            }
+        }
+        week = (week/r.interval + 1)*r.interval;
+        int wd = 0;
+        while (!(r.weekdays & (1 << wd))) wd++;
+        return base + week*7 + wd;
+    }
+    case RECUR_MONTHLY: {
+        int first = ay*12 + am - 1, month = y*12 + m - 1;
+        int target = first + (month - first + r.interval - 1)/r.interval*r.interval;
+        if (target == month && month_index_day(target, r.month_day) < day) target += r.interval;
+        return month_index_day(target, r.month_day);
+    }
+    case RECUR_YEARLY: {
+        int target = ay + (y - ay + r.interval - 1)/r.interval*r.interval;
+        if (target == y && month_index_day(target*12 + r.month - 1, r.month_day) < day) target += r.interval;
+        return month_index_day(target*12 + r.month - 1, r.month_day);
+    }
+    case RECUR_NONE:
+    default:
+        return day;
+    }
+}
+
+static const char *month_names[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+static bool parse_positive(const char *word, int max, int *value)
+{
+    char *end = NULL;
+    long n = strtol(word, &end, 10);
+    if (end == word || *end != '\0' || n < 1 || n > max) return false;
+    *value = n;
+    return true;
+}
+
+static Recur_Kind parse_recur_unit(const char *word)
+{
+    if (strcmp(word, "d") == 0 || strcmp(word, "day") == 0 || strcmp(word, "days") == 0) return RECUR_DAILY;
+    if (strcmp(word, "w") == 0 || strcmp(word, "week") == 0 || strcmp(word, "weeks") == 0) return RECUR_WEEKLY;
+    if (strcmp(word, "m") == 0 || strcmp(word, "month") == 0 || strcmp(word, "months") == 0) return RECUR_MONTHLY;
+    if (strcmp(word, "y") == 0 || strcmp(word, "year") == 0 || strcmp(word, "years") == 0) return RECUR_YEARLY;
+    return RECUR_NONE;
+}
+
+#define RECUR_MAX_WORDS 16
+
+// Parses period specs like `daily`, `weekdays`, `weekly on mon,thu`,
+// `monthly on 15`, `every 2 weeks`, `every 3 days`, `every friday`, `2w` or
+// `yearly`. Whatever the spec leaves out (the weekday, the day of the month)
+// is taken from `start`.
+bool parse_recurrence(const char *spec, int start, Recurrence *r)
+{
+    char buf[256];
+    char *words[RECUR_MAX_WORDS];
+    size_t count = 0, i = 0;
+
+    if (strlen(spec) >= sizeof(buf)) return false;
+    for (size_t j = 0; spec[j]; j++) buf[j] = tolower((unsigned char)spec[j]);
+    buf[strlen(spec)] = '\0';
+    for (char *save = NULL, *word = strtok_r(buf, " ,", &save); word; word = strtok_r(NULL, " ,", &save)) {
+        if (count >= RECUR_MAX_WORDS) return false;
+        words[count++] = word;
+    }
+    if (count == 0) return false;
+
+    *r = (Recurrence) { .interval = 1 };
+    const char *word = words[i++];
+    if (strcmp(word, "daily") == 0) r->kind = RECUR_DAILY;
+    else if (strcmp(word, "weekly") == 0) r->kind = RECUR_WEEKLY;
+    else if (strcmp(word, "monthly") == 0) r->kind = RECUR_MONTHLY;
+    else if (strcmp(word, "yearly") == 0 || strcmp(word, "annually") == 0) r->kind = RECUR_YEARLY;
+    else if (strcmp(word, "weekdays") == 0) {
+        r->kind = RECUR_WEEKLY;
+        r->weekdays = 0x3e;
+    } else if (strcmp(word, "every") == 0) {
+        if (i < count && parse_positive(words[i], RECUR_MAX_INTERVAL, &r->interval)) i++;
+        if (i < count && (r->kind = parse_recur_unit(words[i])) != RECUR_NONE) i++;
+        else if (i < count && parse_weekday(words[i]) >= 0) r->kind = RECUR_WEEKLY; // `every mon,fri`
+        else return false;
+    } else {
+        // `3d`, `2w`, `1m`, `1y`
+        char *end = NULL;
+        long n = strtol(word, &end, 10);
+        if (end == word || n < 1 || n > RECUR_MAX_INTERVAL) return false;
+        r->interval = n;
+        r->kind = parse_recur_unit(end);
+        if (r->kind == RECUR_NONE) return false;
+    }
+
+    if (i < count && strcmp(words[i], "on") == 0) i++;
+    switch (r->kind) {
+    case RECUR_WEEKLY:
+        for (; i < count; i++) {
+            int wd = parse_weekday(words[i]);
+            if (wd < 0) return false;
+            r->weekdays |= 1 << wd;
+        }
+        if (r->weekdays == 0) r->weekdays = 1 << weekday_of(start);
+        break;
+    case RECUR_MONTHLY:
+        if (i < count && strcmp(words[i], "day") == 0) i++;
+        if (i < count && !parse_positive(words[i++], 31, &r->month_day)) return false;
+        break;
+    default:
+        break;
+    }
+    if (i != count) return false;
+
+    int y, m, d;
+    civil_from_days(start, &y, &m, &d);
+    if (r->kind == RECUR_MONTHLY && r->month_day == 0) r->month_day = d;
+    if (r->kind == RECUR_YEARLY) {
+        r->month = m;
+        r->month_day = d;
+    }
+    return true;
+}
+
+#define RECUR_DESCRIPTION_SIZE 80
+
+// Canonical text kept in Reminders.period for listings, `every 2 weeks on Mon,Thu`
+void recurrence_describe(Recurrence r, char buf[RECUR_DESCRIPTION_SIZE])
+{
+    static const char *units[] = {
+        [RECUR_DAILY] = "day", [RECUR_WEEKLY] = "week", [RECUR_MONTHLY] = "month", [RECUR_YEARLY] = "year",
+    };
+    int n;
+
+    if (r.interval == 1) n = snprintf(buf, RECUR_DESCRIPTION_SIZE, "every %s", units[r.kind]);
+    else n = snprintf(buf, RECUR_DESCRIPTION_SIZE, "every %d %ss", r.interval, units[r.kind]);
+
+    switch (r.kind) {
+    case RECUR_WEEKLY:
+        n += snprintf(buf + n, RECUR_DESCRIPTION_SIZE - n, " on");
+        for (int wd = 0, first = 1; wd < 7; wd++) {
+            if (!(r.weekdays & (1 << wd))) continue;
+            n += snprintf(buf + n, RECUR_DESCRIPTION_SIZE - n, "%c%c%.2s", first ? ' ' : ',',
+                          toupper(weekday_names[wd][0]), weekday_names[wd] + 1);
+            first = 0;
+        }
+        break;
+    case RECUR_MONTHLY:
+        n += snprintf(buf + n, RECUR_DESCRIPTION_SIZE - n, " on day %d", r.month_day);
+        break;
+    case RECUR_YEARLY:
+        n += snprintf(buf + n, RECUR_DESCRIPTION_SIZE - n, " on %s %d", month_names[r.month - 1], r.month_day);
+        break;
+    default:
+        break;
+    }
+
+    if (r.until) {
+        char until[DATE_SIZE];
+        day_to_date(r.until, until);
+        snprintf(buf + n, RECUR_DESCRIPTION_SIZE - n, " until %s", until);
+    }
+}
+
+static int compare_series_by_position(const void *a, const void *b)
+{
+    const Series_Occurrence *x = a, *y = b;
+    if (x->scheduled != y->scheduled) return (x->scheduled > y->scheduled) - (x->scheduled < y->scheduled);
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+static int compare_series_by_day(const void *a, const void *b)
+{
+    const Series_Occurrence *x = a, *y = b;
+    if (x->day != y->day) return (x->day > y->day) - (x->day < y->day);
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+// Finds the recurring reminders scheduled before `from` with an occurrence in
+// [from, to] through the Reminder_Spans R*Tree, ordered by that occurrence.
+// `before` receives the number of reminders scheduled before `from`. Without
+// any such series that is a COUNT(*), otherwise the same walk over the index
+// also picks up the positions of the series.
+bool load_series_occurrences(sqlite3 *db, int from, int to, Series_Occurrences *series, int *before)
+{
+    bool result = true;
+    sqlite3_stmt *stmt = prepare_cached(db, STMT_LOAD_SERIES_BEFORE);
+    if (stmt == NULL) return false;
+
+    if (sqlite3_bind_int(stmt, 1, from) != SQLITE_OK) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+
+    int ret;
+    while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+        Recurrence r = recurrence_decode(sqlite3_column_int64(stmt, 4));
+        int scheduled = sqlite3_column_int(stmt, 2);
+        int day = recurrence_on_or_after(r, scheduled, from);
+        if (day > to || (sqlite3_column_type(stmt, 5) != SQLITE_NULL && day > sqlite3_column_int(stmt, 5))) continue;
+
+        const char *period = (const char *)sqlite3_column_text(stmt, 3);
+        Series_Occurrence item = {
+            .id = sqlite3_column_int64(stmt, 0),
+            .scheduled = scheduled,
+            .day = day,
+            .title = arena_strdup(&lore_arena, (const char *)sqlite3_column_text(stmt, 1)),
+            .period = period ? arena_strdup(&lore_arena, period) : NULL,
+        };
+        da_append(series, item);
+    }
+    if (ret != SQLITE_DONE) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+    release_cached(stmt);
+    stmt = NULL;
+
+    if (series->count == 0) return query_int_arg(db, STMT_COUNT_REMINDERS_BEFORE, from, before);
+
+    // The walk visits the series in the same order as the sorted array
+    qsort(series->items, series->count, sizeof(*series->items), compare_series_by_position);
+    stmt = prepare_cached(db, STMT_LOAD_REMINDER_IDS_BEFORE);
+    if (stmt == NULL) return_defer(false);
+
+    if (sqlite3_bind_int(stmt, 1, from) != SQLITE_OK) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+
+    size_t next = 0;
+    int index = 0;
+    for (; (ret = sqlite3_step(stmt)) == SQLITE_ROW; index++) {
+        if (next < series->count && sqlite3_column_int64(stmt, 0) == series->items[next].id) series->items[next++].index = index;
+    }
+    if (ret != SQLITE_DONE) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+    *before = index;
+    qsort(series->items, series->count, sizeof(*series->items), compare_series_by_day);
+
+defer:
+    if (stmt) release_cached(stmt);
+    return result;
+}
+
+// ** Calendar **
+
+#define CAL_MONTH_WIDTH 21 // 7 day cells of 3 characters
+
+typedef struct {
+    int year;
+    int first_month;   // 1-12
+    int count;         // 1 or 12 months
+    uint32_t days[12]; // bit d - 1 is set when a reminder falls on day d
+} Calendar;
+
+static const char *month_full_names[] = {
+    "January", "February", "March", "April", "May", "June",
+    "July", "August", "September", "October", "November", "December",
+};
+
+static void calendar_mark(Calendar *cal, int day)
+{
+    int y, m, d;
+    civil_from_days(day, &y, &m, &d);
+    cal->days[m - cal->first_month] |= 1u << (d - 1);
+}
+
+// Fills the day bitmaps in one pass over the reminders whose span overlaps the
+// shown range, found through the Reminder_Spans R*Tree. Recurring ones jump
+// from occurrence to occurrence, so a reminder costs one step per marked day.
+bool load_calendar(sqlite3 *db, Calendar *cal)
+{
+    bool result = true;
+    int last_month = cal->first_month + cal->count - 1;
+    int start = days_from_civil(cal->year, cal->first_month, 1);
+    int end = days_from_civil(cal->year, last_month, days_in_month(cal->year, last_month));
+
+    sqlite3_stmt *stmt = prepare_cached(db, STMT_LOAD_CALENDAR);
+    if (stmt == NULL) return false;
+
+    if (sqlite3_bind_int(stmt, 1, start) != SQLITE_OK || sqlite3_bind_int(stmt, 2, end) != SQLITE_OK) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+
+    int ret;
+    while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+        int scheduled = sqlite3_column_int(stmt, 0);
+        if (sqlite3_column_type(stmt, 1) == SQLITE_NULL) {
+            calendar_mark(cal, scheduled);
+            continue;
+        }
+        Recurrence r = recurrence_decode(sqlite3_column_int64(stmt, 1));
+        int last = end;
+        if (sqlite3_column_type(stmt, 2) != SQLITE_NULL && sqlite3_column_int(stmt, 2) < end) last = sqlite3_column_int(stmt, 2);
+        for (int day = recurrence_on_or_after(r, scheduled, start); day <= last; day = recurrence_on_or_after(r, scheduled, day + 1)) {
+            calendar_mark(cal, day);
+        }
+    }
+    trace_phase("load calendar");
+
+    if (ret != SQLITE_DONE) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+
+defer:
+    release_cached(stmt);
+    return result;
+}
+
+static void sb_append_centered(String_Builder *sb, const char *text, int width)
+{
+    int len = strlen(text);
+    int left = (width - len)/2;
+    for (int i = 0; i < left; i++) sb_append_cstr(sb, " ");
+    sb_append_cstr(sb, text);
+    for (int i = left + len; i < width; i++) sb_append_cstr(sb, " ");
+}
+
+// One of the 6 week rows of month `i` of the calendar. Days with reminders are
+// shown in reverse video on a terminal and followed by `*` otherwise, today is
+// underlined on a terminal.
+static void render_calendar_week(String_Builder *out, const Calendar *cal, int i, int week, bool tty, int today)
+{
+    int month = cal->first_month + i;
+    int first = days_from_civil(cal->year, month, 1);
+    int length = days_in_month(cal->year, month);
+
+    for (int wd = 0; wd < 7; wd++) {
+        int d = week*7 + wd - weekday_of(first) + 1;
+        if (d < 1 || d > length) {
+            sb_append_cstr(out, "   ");
+            continue;
+        }
+        bool marked = cal->days[i] & (1u << (d - 1));
+        char cell[] = {d >= 10 ? '0' + d/10 : ' ', '0' + d%10, '\0'};
+        if (tty && marked) sb_append_cstr(out, "\033[7m");
+        if (tty && first + d - 1 == today) sb_append_cstr(out, "\033[4m");
+        sb_append_cstr(out, cell);
+        if (tty && (marked || first + d - 1 == today)) sb_append_cstr(out, "\033[0m");
+        sb_append_cstr(out, !tty && marked ? "*" : " ");
+    }
+}
+
+// `ncal -C` like layout, a single month or the whole year three months wide
+void render_calendar(String_Builder *out, const Calendar *cal, bool tty, int today)
+{
+    int per_row = cal->count == 1 ? 1 : 3;
+    char title[64];
+
+    if (cal->count > 1) {
+        snprintf(title, sizeof(title), "%d", cal->year);
+        sb_append_centered(out, title, per_row*(CAL_MONTH_WIDTH + 1) - 2);
+        sb_append_cstr(out, "\n\n");
+    }
+
+    for (int row = 0; row < cal->count; row += per_row) {
+        for (int i = row; i < row + per_row; i++) {
+            if (cal->count == 1) snprintf(title, sizeof(title), "%s %d", month_full_names[cal->first_month - 1], cal->year);
+            else snprintf(title, sizeof(title), "%s", month_full_names[cal->first_month + i - 1]);
+            sb_append_centered(out, title, CAL_MONTH_WIDTH - 1);
+            sb_append_cstr(out, i + 1 < row + per_row ? "  " : "\n");
+        }
+        for (int i = row; i < row + per_row; i++) {
+            sb_append_cstr(out, "Su Mo Tu We Th Fr Sa");
+            sb_append_cstr(out, i + 1 < row + per_row ? "  " : "\n");
+        }
+        for (int week = 0; week < 6; week++) {
+            for (int i = row; i < row + per_row; i++) {
+                render_calendar_week(out, cal, i, week, tty, today);
+                if (i + 1 < row + per_row) sb_append_cstr(out, " ");
+            }
+            sb_append_cstr(out, "\n");
+        }
+        if (row + per_row < cal->count) sb_append_cstr(out, "\n");
+    }
+}
+
+bool show_calendar(sqlite3 *db, Calendar *cal)
+{
+    Output out = { .fd = STDOUT_FILENO };
+    if (!load_calendar(db, cal)) return false;
+    render_calendar(&out.sb, cal, isatty(STDOUT_FILENO), local_today());
+    if (!out_flush(&out)) return false;
+    trace_phase("render write");
+    return true;
+}
+
+// `lore cal` arguments: nothing or `month` for this month, `year` for this
+// year, `YYYY` for a year, `YYYY-MM` or a month name for a single month.
+bool parse_calendar_range(const char *arg, int today, Calendar *cal)
+{
+    int y, m, d;
+    civil_from_days(today, &y, &m, &d);
+    *cal = (Calendar) { .year = y, .first_month = m, .count = 1 };
+    if (arg == NULL || strcmp(arg, "month") == 0) return true;
+    if (strcmp(arg, "year") == 0) {
+        cal->first_month = 1;
+        cal->count = 12;
+        return true;
+    }
+
+    char *end = NULL;
+    long n = strtol(arg, &end, 10);
+    if (end != arg && *end == '\0' && n >= 1 && n <= 9999 && end - arg == 4) {
+        *cal = (Calendar) { .year = n, .first_month = 1, .count = 12 };
+        return true;
+    }
+    if (end != arg && *end == '-' && n >= 1 && n <= 9999) {
+        char *month_end = NULL;
+        long month = strtol(end + 1, &month_end, 10);
+        if (month_end == end + 1 || *month_end != '\0' || month < 1 || month > 12) return false;
+        *cal = (Calendar) { .year = n, .first_month = month, .count = 1 };
+        return true;
+    }
+
+    size_t len = strlen(arg);
+    for (int i = 0; len >= 3 && i < 12; i++) {
+        if (len <= strlen(month_full_names[i]) && strncasecmp(arg, month_full_names[i], len) == 0) {
+            cal->first_month = i + 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Inserts a reminder without touching the next due watermark, `recurrence` is
+// NULL for one-off reminders
+bool insert_reminder(sqlite3 *db, const char *title, int scheduled_at, const Recurrence *recurrence)
+{
+    bool result = true;
+    sqlite3_stmt *stmt = prepare_cached(db, STMT_INSERT_REMINDER);
+    if (stmt == NULL) return false;
+
+    if (sqlite3_bind_text(stmt, 1, title, strlen(title), NULL) != SQLITE_OK) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+
+    if (sqlite3_bind_int(stmt, 2, scheduled_at) != SQLITE_OK) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+
+    if (recurrence) {
+        char period[RECUR_DESCRIPTION_SIZE];
+        recurrence_describe(*recurrence, period);
+        if (sqlite3_bind_text(stmt, 3, period, -1, SQLITE_TRANSIENT) != SQLITE_OK ||
+                sqlite3_bind_int64(stmt, 4, recurrence_encode(*recurrence)) != SQLITE_OK ||
+                (recurrence->until && sqlite3_bind_int(stmt, 5, recurrence->until) != SQLITE_OK)) {
+            fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+            return_defer(false);
+        }
+    }
+
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+    release_cached(stmt);
+
+    stmt = prepare_cached(db, STMT_INSERT_SPAN);
+    if (stmt == NULL) return false;
+
+    int last_day = scheduled_at;
+    if (recurrence) last_day = recurrence->until ? recurrence->until : DAY_MAX;
+    if (sqlite3_bind_int64(stmt, 1, sqlite3_last_insert_rowid(db)) != SQLITE_OK ||
+            sqlite3_bind_int(stmt, 2, scheduled_at) != SQLITE_OK ||
+            sqlite3_bind_int(stmt, 3, last_day) != SQLITE_OK ||
+            sqlite3_step(stmt) != SQLITE_DONE) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+
+defer:
+    release_cached(stmt);
+    return result;
+}
+
+// `recurrence` is NULL for one-off reminders
+bool create_new_reminder(sqlite3 *db, const char *title, int scheduled_at, const Recurrence *recurrence)
+{
+    bool result = true;
+    sqlite3_stmt *stmt = NULL;
+
+    if (!insert_reminder(db, title, scheduled_at, recurrence)) return false;
+
+    stmt = prepare_cached(db, STMT_LOWER_NEXT_DUE);
+    if (stmt == NULL) return_defer(false);
+
+    if (sqlite3_bind_int(stmt, 1, scheduled_at) != SQLITE_OK) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+
+defer:
+    if (stmt) release_cached(stmt);
+    return result;
+}
+
+// Finishes reminder `id`. A recurring reminder stays the same row, its date
+// moves to the first occurrence after `today`, or after `scheduled` when it is
+// completed ahead of time, until the series ends. `next` receives the new
+// date, DAY_MAX once finished. Its Reminder_Spans entry follows along.
+bool complete_reminder(sqlite3 *db, int64_t id, int scheduled, Recurrence recurrence, int today, int *next)
+{
+    bool result = true;
+    sqlite3_stmt *stmt = NULL;
+
+    if (recurrence.kind != RECUR_NONE) {
+        *next = recurrence_on_or_after(recurrence, scheduled, (today > scheduled ? today : scheduled) + 1);
+        if (recurrence.until && *next > recurrence.until) recurrence.kind = RECUR_NONE;
+    }
+
+    if (recurrence.kind == RECUR_NONE) {
+        *next = DAY_MAX;
+        stmt = prepare_cached(db, STMT_FINISH_REMINDER);
+        if (stmt == NULL) return_defer(false);
+        if (sqlite3_bind_int64(stmt, 1, id) != SQLITE_OK) {
+            fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+            return_defer(false);
+        }
+    } else {
+        stmt = prepare_cached(db, STMT_ADVANCE_REMINDER);
+        if (stmt == NULL) return_defer(false);
+        if (sqlite3_bind_int(stmt, 1, *next) != SQLITE_OK ||
+                sqlite3_bind_int64(stmt, 2, id) != SQLITE_OK) {
+            fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+            return_defer(false);
+        }
+    }
+
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+    release_cached(stmt);
+
+    if (*next == DAY_MAX) {
+        stmt = prepare_cached(db, STMT_DELETE_SPAN);
+        if (stmt == NULL) return false;
+        if (sqlite3_bind_int64(stmt, 1, id) != SQLITE_OK) {
+            fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+            return_defer(false);
+        }
+    } else {
+        stmt = prepare_cached(db, STMT_MOVE_SPAN);
+        if (stmt == NULL) return false;
+        if (sqlite3_bind_int(stmt, 1, *next) != SQLITE_OK || sqlite3_bind_int64(stmt, 2, id) != SQLITE_OK) {
+            fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+            return_defer(false);
+        }
+    }
+
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+
+defer:
+    if (stmt) release_cached(stmt);
+    return result;
+}
+
+// Completes the reminder at `index` of the unfiltered listing
+bool finish_reminder_by_index(sqlite3 *db, int index)
+{
+    bool result = true;
+    sqlite3_stmt *stmt = NULL;
+    int64_t id = 0;
+    int scheduled = 0, next = 0;
+    Recurrence recurrence = {0};
+
+    if (index < 0) {
+        fprintf(stderr, "ERROR: %d is not a valid index of an active reminder.\n", index);
+        return_defer(false);
+    }
+
+    stmt = prepare_cached(db, STMT_REMINDER_AT);
+    if (stmt == NULL) return_defer(false);
+
+    if (sqlite3_bind_int(stmt, 1, index) != SQLITE_OK) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+
+    int ret = sqlite3_step(stmt);
+    if (ret == SQLITE_DONE) {
+        fprintf(stderr, "ERROR: %d is not a valid index of an active reminder.\n", index);
+        return_defer(false);
+    }
+    if (ret != SQLITE_ROW) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+    id = sqlite3_column_int64(stmt, 0);
+    scheduled = sqlite3_column_int(stmt, 1);
+    if (sqlite3_column_type(stmt, 2) != SQLITE_NULL) recurrence = recurrence_decode(sqlite3_column_int64(stmt, 2));
+    recurrence.until = sqlite3_column_int(stmt, 3);
+    release_cached(stmt);
+    stmt = NULL;
+
+    if (!complete_reminder(db, id, scheduled, recurrence, local_today(), &next)) return_defer(false);
+
+    // The finished reminder might have been the one holding the watermark
+    if (!exec_cached(db, STMT_REFRESH_NEXT_DUE)) return_defer(false);
+
+defer:
+    if (stmt) release_cached(stmt);
+    return result;
+}
+
+// ** Scheduler **
+//
+// `lore scheduler` keeps every unfinished reminder in a min-heap keyed by its
+// due day and sleeps on a timerfd armed for local midnight of the earliest one.
+// Due reminders become notifications, recurring ones move on to their next
+// occurrence and one-offs are finished. Commits of other lore processes are
+// noticed through inotify on the database directory and confirmed with
+// `PRAGMA data_version`, which only changes for commits of other connections.
+
+#define SCHEDULER_RETRY_SECONDS 5
+
+typedef struct {
+    int due; // day number
+    int64_t id;
+} Due_Reminder;
+
+typedef struct {
+    Due_Reminder *items;
+    size_t count;
+    size_t capacity;
+} Due_Heap;
+
+static bool due_before(Due_Reminder a, Due_Reminder b)
+{
+    return a.due < b.due || (a.due == b.due && a.id < b.id);
+}
+
+void due_heap_push(Due_Heap *heap, Due_Reminder item)
+{
+    da_append(heap, item);
+    for (size_t i = heap->count - 1; i > 0;) {
+        size_t parent = (i - 1)/2;
+        if (!due_before(heap->items[i], heap->items[parent])) break;
+        Due_Reminder tmp = heap->items[i];
+        heap->items[i] = heap->items[parent];
+        heap->items[parent] = tmp;
+        i = parent;
+    }
+}
+
+Due_Reminder due_heap_pop(Due_Heap *heap)
+{
+    assert(heap->count > 0);
+    Due_Reminder top = heap->items[0];
+    heap->items[0] = heap->items[--heap->count];
+    for (size_t i = 0;;) {
+        size_t least = i, left = 2*i + 1, right = 2*i + 2;
+        if (left < heap->count && due_before(heap->items[left], heap->items[least])) least = left;
+        if (right < heap->count && due_before(heap->items[right], heap->items[least])) least = right;
+        if (least == i) break;
+        Due_Reminder tmp = heap->items[i];
+        heap->items[i] = heap->items[least];
+        heap->items[least] = tmp;
+        i = least;
+    }
+    return top;
+}
+
+// Rebuilds the heap from the unfinished reminders, reusing its storage
+bool load_due_heap(sqlite3 *db, Due_Heap *heap)
+{
+    bool result = true;
+    sqlite3_stmt *stmt = prepare_cached(db, STMT_LOAD_PENDING_REMINDERS);
+    if (stmt == NULL) return false;
+
+    heap->count = 0;
+    int ret;
+    while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+        due_heap_push(heap, (Due_Reminder) { .due = sqlite3_column_int(stmt, 1), .id = sqlite3_column_int64(stmt, 0) });
+    }
+
+    if (ret != SQLITE_DONE) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+
+defer:
+    release_cached(stmt);
+    return result;
+}
+
+// Delivers reminder `id` as a notification and completes it. `next` receives
+// its next due day, DAY_MAX when there is none.
+bool deliver_reminder(sqlite3 *db, Output *out, int64_t id, int today, int *next)
+{
+    bool result = true;
+    sqlite3_stmt *stmt = prepare_cached(db, STMT_LOAD_REMINDER);
+    if (stmt == NULL) return false;
+
+    *next = DAY_MAX;
+    if (sqlite3_bind_int64(stmt, 1, id) != SQLITE_OK) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+
+    int ret = sqlite3_step(stmt);
+    if (ret == SQLITE_DONE) return_defer(true); // finished or deleted since the heap was loaded
+    if (ret != SQLITE_ROW) {
+        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+        return_defer(false);
+    }
+
+    const char *title = (const char *)sqlite3_column_text(stmt, 0);
+    int scheduled = sqlite3_column_int(stmt, 1);
+    Recurrence recurrence = {0};
+    if (sqlite3_column_type(stmt, 2) != SQLITE_NULL) recurrence = recurrence_decode(sqlite3_column_int64(stmt, 2));
+    recurrence.until = sqlite3_column_int(stmt, 3);
+
+    if (!create_notification_with_title(db, title)) return_defer(false);
+    sb_appendf(&out->sb, "Reminder due: %s\n", title);
+    if (!complete_reminder(db, id, scheduled, recurrence, today, next)) return_defer(false);
+
+defer:
+    release_cached(stmt);
+    return result;
+}
+
+// Delivers every reminder due on or before `today` in a single write and
+// reports them to `out` once it committed. On failure the write is rolled
+// back, nothing is reported and the heap has to be reloaded.
+bool deliver_due_reminders(sqlite3 *db, Output *out, Due_Heap *heap, int today)
+{
+    bool result = true;
+    if (heap->count == 0 || heap->items[0].due > today) return true;
+
+    if (!begin_write(db)) return false;
+    while (heap->count > 0 && heap->items[0].due <= today) {
+        Due_Reminder item = due_heap_pop(heap);
+        int next = DAY_MAX;
+        if (!deliver_reminder(db, out, item.id, today, &next)) return_defer(false);
+        if (next != DAY_MAX) due_heap_push(heap, (Due_Reminder) { .due = next, .id = item.id });
+    }
+    if (!exec_cached(db, STMT_REFRESH_NEXT_DUE)) return_defer(false);
+    if (!end_write(db)) return_defer(false);
+    out_flush(out);
+
+defer:
+    if (!result && !sqlite3_get_autocommit(db)) exec_cached(db, STMT_ROLLBACK);
+    if (!result) out_discard(out);
+    return result;
+}
+
+// Epoch seconds of local midnight at the start of `day`
+time_t local_midnight(int day)
+{
+    int y, m, d;
+    civil_from_days(day, &y, &m, &d);
+    struct tm tm = { .tm_year = y - 1900, .tm_mon = m - 1, .tm_mday = d, .tm_isdst = -1 };
+    return mktime(&tm);
+}
+
+// Arms `timer_fd` for the absolute time `at`, 0 disarms it. Clock changes
+// cancel the timer so the deadline gets recomputed.
+static bool arm_timer(int timer_fd, time_t at)
+{
+    struct itimerspec spec = { .it_value = { .tv_sec = at } };
+    return timerfd_settime(timer_fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &spec, NULL) == 0;
+}
+
+// Drains the inotify queue and tells whether any event touched the database
+// file `name` or its write-ahead log
+static bool database_touched(int inotify_fd, const char *name)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    size_t name_len = strlen(name);
+    bool touched = false;
+
+    for (;;) {
+        ssize_t n = read(inotify_fd, buf, sizeof(buf));
+        if (n <= 0) break;
+        for (char *p = buf; p < buf + n;) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            if (event->mask & IN_Q_OVERFLOW) touched = true;
+            if (event->len > 0 && strncmp(event->name, name, name_len) == 0 &&
+                    (event->name[name_len] == '\0' || strcmp(event->name + name_len, "-wal") == 0)) {
+                touched = true;
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return touched;
+}
+
+bool run_scheduler(sqlite3 *db)
+{
+    bool result = true;
+    int timer_fd = -1, inotify_fd = -1, signal_fd = -1;
+    Due_Heap heap = {0};
+    Output out = { .fd = STDOUT_FILENO };
+    int data_version = 0;
+    char dir[PATH_MAX];
+
+    const char *db_path = sqlite3_db_filename(db, "main");
+    const char *slash = db_path ? strrchr(db_path, '/') : NULL;
+    if (slash == NULL || (size_t)(slash - db_path) >= sizeof(dir)) {
+        fprintf(stderr, "ERROR: scheduler needs an absolute database path\n");
+        return false;
+    }
+    snprintf(dir, sizeof(dir), "%.*s", (int)(slash - db_path), db_path);
+    if (dir[0] == '\0') strcpy(dir, "/");
+    const char *name = slash + 1;
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0 ||
+            (signal_fd = signalfd(-1, &mask, SFD_CLOEXEC)) < 0 ||
+            (timer_fd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC)) < 0 ||
+            (inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0 ||
+            inotify_add_watch(inotify_fd, dir, IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+        fprintf(stderr, "ERROR: scheduler: %s\n", strerror(errno));
+        return_defer(false);
+    }
+
+    // Lock waits back off like those of every other read-write connection, see
+    // `install_busy_handler`
+    if (!query_int(db, STMT_DATA_VERSION, &data_version)) return_defer(false);
+    sb_appendf(&out.sb, "Scheduler started for %s\n", db_path);
+    out_flush(&out);
+
+    bool reload = true;
+    for (;;) {
+        time_t wake = 0;
+        if ((reload && !load_due_heap(db, &heap)) || !deliver_due_reminders(db, &out, &heap, local_today())) {
+            fprintf(stderr, "ERROR: could not deliver due reminders, retrying in %d seconds\n", SCHEDULER_RETRY_SECONDS);
+            reload = true;
+            wake = time(NULL) + SCHEDULER_RETRY_SECONDS;
+        } else {
+            reload = false;
+            if (heap.count > 0) wake = local_midnight(heap.items[0].due);
+        }
+
+        if (!arm_timer(timer_fd, wake)) {
+            fprintf(stderr, "ERROR: scheduler: timerfd_settime: %s\n", strerror(errno));
+            return_defer(false);
+        }
+
+        struct pollfd fds[] = {
+            { .fd = timer_fd,   .events = POLLIN },
+            { .fd = inotify_fd, .events = POLLIN },
+            { .fd = signal_fd,  .events = POLLIN },
+        };
+        if (poll(fds, sizeof(fds)/sizeof(fds[0]), -1) < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "ERROR: scheduler: poll: %s\n", strerror(errno));
+            return_defer(false);
+        }
+
+        if (fds[2].revents & POLLIN) break;
+
+        if (fds[0].revents & POLLIN) {
+            uint64_t expirations;
+            // ECANCELED after a clock change, the next iteration re-arms either way
+            if (read(timer_fd, &expirations, sizeof(expirations)) < 0 && errno != ECANCELED && errno != EAGAIN) {
+                fprintf(stderr, "ERROR: scheduler: timerfd: %s\n", strerror(errno));
+                return_defer(false);
+            }
+        }
+
+        if ((fds[1].revents & POLLIN) && database_touched(inotify_fd, name)) {
+            int version = 0;
+            if (!query_int(db, STMT_DATA_VERSION, &version)) return_defer(false);
+            if (version != data_version) {
+                data_version = version;
+                reload = true;
+            }
+        }
+    }
+    sb_append_cstr(&out.sb, "Scheduler stopped\n");
+    out_flush(&out);
+
+defer:
+    if (timer_fd >= 0) close(timer_fd);
+    if (inotify_fd >= 0) close(inotify_fd);
+    if (signal_fd >= 0) close(signal_fd);
+    return result;
+}
+
+// ** iCalendar **
+//
+// Just enough of RFC 5545 to move reminders in and out of calendar apps: all
+// day VEVENTs with a SUMMARY, a DTSTART and optionally an RRULE that maps onto
+// a Recurrence, UNTIL and COUNT included. Both directions stream, an import holds a single unfolded line
+// and event in memory no matter how big the file is.
+
+#define ICS_LINE_WIDTH 75
+
+static const char *ics_weekdays[] = {"SU", "MO", "TU", "WE", "TH", "FR", "SA"};
+
+typedef struct {
+    bool in_event;
+    int depth;            // of nested components like VALARM, their properties are not the event's
+    String_Builder title;
+    bool has_start;
+    int start;
+    String_Builder rule;  // RRULE value, parsed once DTSTART is known for sure
+} Ics_Event;
+
+typedef struct {
+    size_t imported;
+    size_t skipped;       // no SUMMARY or DTSTART, or an event or series that is over
+    size_t simplified;    // RRULE lore can not express, imported as a one-off
+    size_t unsupported;   // RRULE lore can not express starting in the past, skipped
+} Ics_Stats;
+
+// DATE or DATE-TIME values, only the date part matters for reminders
+static bool parse_ics_date(const char *value, int *day)
+{
+    int fields[3] = {0};
+    static const int widths[] = {4, 2, 2};
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < widths[i]; j++, value++) {
+            if (!isdigit((unsigned char)*value)) return false;
+            fields[i] = fields[i]*10 + (*value - '0');
+        }
+    }
+    if (*value != '\0' && *value != 'T') return false;
+    if (fields[1] < 1 || fields[1] > 12 || fields[2] < 1 || fields[2] > days_in_month(fields[0], fields[1])) return false;
+    *day = days_from_civil(fields[0], fields[1], fields[2]);
+    return true;
+}
+
+#define ICS_MAX_COUNT 100000
+
+// Shortest length of the months a monthly or yearly recurrence can land in
+static int recurrence_shortest_month(Recurrence r)
+{
+    return r.kind == RECUR_YEARLY ? days_in_month(2001, r.month) : 28;
+}
+
+// FREQ, INTERVAL, BYDAY (plain weekdays), BYMONTHDAY and BYMONTH (single
+// values that agree with DTSTART), UNTIL and COUNT. Anything else can not be
+// represented.
+//
+// RFC 5545 skips months that lack the day of the month, lore moves the
+// occurrence to their last day instead. Only rules that say so, the way
+// `ics_format_rrule` writes them, are taken for days past 28: BYMONTHDAY=-1
+// or a run of days ending in it with BYSETPOS=-1.
+static bool parse_rrule(char *value, int start, Recurrence *r)
+{
+    int y, m, d;
+    int count = 0;
+    uint32_t month_days = 0; // bit `day - 1` for every BYMONTHDAY
+    bool last_month_day = false, last_of_set = false;
+    civil_from_days(start, &y, &m, &d);
+    *r = (Recurrence) { .interval = 1 };
+
+    for (char *save = NULL, *part = strtok_r(value, ";", &save); part; part = strtok_r(NULL, ";", &save)) {
+        char *val = strchr(part, '=');
+        if (val == NULL) return false;
+        *val++ = '\0';
+
+        if (strcasecmp(part, "FREQ") == 0) {
+            if (strcasecmp(val, "DAILY") == 0) r->kind = RECUR_DAILY;
+            else if (strcasecmp(val, "WEEKLY") == 0) r->kind = RECUR_WEEKLY;
+            else if (strcasecmp(val, "MONTHLY") == 0) r->kind = RECUR_MONTHLY;
+            else if (strcasecmp(val, "YEARLY") == 0) r->kind = RECUR_YEARLY;
+            else return false;
+        } else if (strcasecmp(part, "INTERVAL") == 0) {
+            if (!parse_positive(val, RECUR_MAX_INTERVAL, &r->interval)) return false;
+        } else if (strcasecmp(part, "BYDAY") == 0) {
+            for (char *save_day = NULL, *day = strtok_r(val, ",", &save_day); day; day = strtok_r(NULL, ",", &save_day)) {
+                int wd = 0;
+                while (wd < 7 && strcasecmp(day, ics_weekdays[wd]) != 0) wd++;
+                if (wd == 7) return false; // `2TU`, `-1FR`...
+                r->weekdays |= 1 << wd;
+            }
+        } else if (strcasecmp(part, "BYMONTHDAY") == 0) {
+            for (char *save_day = NULL, *day = strtok_r(val, ",", &save_day); day; day = strtok_r(NULL, ",", &save_day)) {
+                int month_day = 0;
+                if (strcmp(day, "-1") == 0) last_month_day = true;
+                else if (parse_positive(day, 31, &month_day)) month_days |= 1u << (month_day - 1);
+                else return false;
+            }
+        } else if (strcasecmp(part, "BYSETPOS") == 0) {
+            if (strcmp(val, "-1") != 0) return false;
+            last_of_set = true;
+        } else if (strcasecmp(part, "BYMONTH") == 0) {
+            int month = 0;
+            if (!parse_positive(val, 12, &month) || month != m) return false;
+        } else if (strcasecmp(part, "UNTIL") == 0) {
+            if (!parse_ics_date(val, &r->until)) return false;
+        } else if (strcasecmp(part, "COUNT") == 0) {
+            if (!parse_positive(val, ICS_MAX_COUNT, &count)) return false;
+        } else if (strcasecmp(part, "WKST") != 0) {
+            return false;
+        }
+    }
+
+    bool clamped = false;
+    if (last_month_day) {
+        if (month_days != 0 || last_of_set) return false;
+        r->month_day = 31;
+        clamped = true;
+    } else if (month_days != 0) {
+        int first = 1, last = 31;
+        while (!(month_days & (1u << (first - 1)))) first++;
+        while (!(month_days & (1u << (last - 1)))) last--;
+        uint32_t run = ((1u << last) - 1) & ~((1u << (first - 1)) - 1);
+        if (first != last) {
+            // The last of the days a month has
+            if (!last_of_set || month_days != run || first > 28) return false;
+            clamped = true;
+        }
+        r->month_day = last;
+    } else if (last_of_set) {
+        return false;
+    }
+
+    switch (r->kind) {
+    case RECUR_DAILY:
+        if (r->weekdays != 0 || r->month_day != 0) return false;
+        break;
+    case RECUR_WEEKLY:
+        if (r->month_day != 0) return false;
+        if (r->weekdays == 0) r->weekdays = 1 << weekday_of(start);
+        break;
+    case RECUR_MONTHLY:
+        if (r->weekdays != 0) return false;
+        if (r->month_day == 0) r->month_day = d;
+        break;
+    case RECUR_YEARLY:
+        if (r->weekdays != 0) return false;
+        r->month = m;
+        if (r->month_day == 0) r->month_day = d;
+        break;
+    default:
+        return false;
+    }
+    if (!clamped && r->month_day > recurrence_shortest_month(*r)) return false;
+
+    // COUNT ends the series on the day of its last occurrence, DTSTART being
+    // the first one
+    if (count > 0) {
+        int day = start;
+        for (int i = 1; i < count && day <= DAY_MAX; i++) day = recurrence_on_or_after(*r, start, day + 1);
+        if (day <= DAY_MAX && (r->until == 0 || day < r->until)) r->until = day;
     }
-
-defer:
-    if (stmt) sqlite3_finalize(stmt);
-    return result;
+    return true;
 }
 
-bool dismiss_notification_by_index(sqlite3 *db, int index)
-{   
-    bool result = true;
+// TEXT values: `\n` becomes a space since titles are single lines
+static void ics_unescape(const char *value, String_Builder *out)
+{
+    out->count = 0;
+    for (const char *p = value; *p; p++) {
+        char c = *p;
+        if (c == '\\' && p[1] != '\0') {
+            c = *++p;
+            if (c == 'n' || c == 'N') c = ' ';
+        }
+        sb_append_buf(out, &c, 1);
+    }
+    sb_append_null(out);
+}
 
-    Notifications notifs = {0};
-    if (!load_active_notifications(db, &notifs)) return_defer(false);
-    if (!(0 <= index && (size_t)index < notifs.count)) {
-        fprintf(stderr, "ERROR: %d is not a valid index of an active notification.\n", index);
-        return_defer(false);
+static bool ics_finish_event(sqlite3 *db, Ics_Event *event, Ics_Stats *stats)
+{
+    if (!event->has_start || event->title.count <= 1) {
+        stats->skipped++;
+        return true;
     }
 
-    if (!dismiss_notification_by_id(db, notifs.items[index].id)) return_defer(false);
+    int today = local_today();
+    int scheduled_at = event->start;
+    Recurrence rule = {0};
+    const Recurrence *recurrence = NULL;
+    if (event->rule.count > 0 && parse_rrule(event->rule.items, event->start, &rule)) {
+        // A series that started long ago is due again at its next occurrence
+        recurrence = &rule;
+        scheduled_at = recurrence_on_or_after(rule, event->start, today);
+        if (rule.until && scheduled_at > rule.until) {
+            stats->skipped++;
+            return true;
+        }
+    } else if (scheduled_at < today) {
+        // Calendar history, not something that is still to be done. A series
+        // lore can not follow is reported, it might not be over.
+        if (event->rule.count > 0) stats->unsupported++;
+        else stats->skipped++;
+        return true;
+    } else if (event->rule.count > 0) {
+        stats->simplified++;
+    }
 
-defer:
-    free(notifs.items);
-    return result;
+    if (!insert_reminder(db, event->title.items, scheduled_at, recurrence)) return false;
+    stats->imported++;
+    return true;
 }
 
-bool show_active_reminders(sqlite3 *db) {
-    assert(0 && "NOT IMPLEMENTED: show active reminders");
+// Handles one unfolded content line, `NAME;PARAM=...:VALUE`
+static bool ics_handle_line(sqlite3 *db, char *line, Ics_Event *event, Ics_Stats *stats)
+{
+    // The value starts at the first colon outside of quoted parameter values
+    char *value = line;
+    for (bool quoted = false; *value && (quoted || *value != ':'); value++) {
+        if (*value == '"') quoted = !quoted;
+    }
+    if (*value != ':') return true;
+    *value++ = '\0';
+    char *params = strchr(line, ';');
+    if (params) *params = '\0';
+
+    if (strcasecmp(line, "BEGIN") == 0) {
+        if (event->in_event) {
+            event->depth++;
+        } else if (strcasecmp(value, "VEVENT") == 0) {
+            event->in_event = true;
+            event->depth = 0;
+            event->title.count = 0;
+            event->rule.count = 0;
+            event->has_start = false;
+        }
+        return true;
+    }
+    if (!event->in_event) return true;
+
+    if (strcasecmp(line, "END") == 0) {
+        if (event->depth > 0) {
+            event->depth--;
+            return true;
+        }
+        event->in_event = false;
+        return ics_finish_event(db, event, stats);
+    }
+    if (event->depth > 0) return true;
+
+    if (strcasecmp(line, "SUMMARY") == 0) {
+        ics_unescape(value, &event->title);
+    } else if (strcasecmp(line, "DTSTART") == 0) {
+        event->has_start = parse_ics_date(value, &event->start);
+    } else if (strcasecmp(line, "RRULE") == 0) {
+        event->rule.count = 0;
+        sb_append_cstr(&event->rule, value);
+        sb_append_null(&event->rule);
+    }
+    return true;
 }
 
-bool create_new_reminder(sqlite3 *db, const char *title, const char *scheduled_at, const char *period)
+// Imports the VEVENTs of `in` as reminders through the cached insert statement,
+// committing every `batch_size` events.
+bool import_reminders_ics(sqlite3 *db, FILE *in, size_t batch_size, Ics_Stats *stats)
 {
     bool result = true;
-    sqlite3_stmt *stmt = NULL;
-
-    if (sqlite3_prepare_v2(db, "INSERT INTO Reminders (title, scheduled_at, period) VALUES (?, ?, ?)", -1, &stmt, NULL) != SQLITE_OK) {
-        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
-        return_defer(false);
-    }
+    char *line = NULL;
+    size_t line_cap = 0;
+    String_Builder logical = {0};
+    Ics_Event event = {0};
+    size_t committed = 0;
+
+    if (!begin_write(db)) return_defer(false);
+
+    ssize_t n;
+    for (;;) {
+        n = getline(&line, &line_cap, in);
+        while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r')) line[--n] = '\0';
+
+        // Folded lines continue with a single space or tab
+        if (n > 0 && (line[0] == ' ' || line[0] == '\t') && logical.count > 0) {
+            logical.count--;
+            sb_append_buf(&logical, line + 1, n - 1);
+            sb_append_null(&logical);
+            continue;
+        }
 
-    if (sqlite3_bind_text(stmt, 1, title, strlen(title), NULL) != SQLITE_OK) {
-        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
-        return_defer(false);
-    }
+        if (logical.count > 0) {
+            if (!ics_handle_line(db, logical.items, &event, stats)) return_defer(false);
+            logical.count = 0;
+        }
+        if (n < 0) break;
+        sb_append_buf(&logical, line, n);
+        sb_append_null(&logical);
 
-    if (sqlite3_bind_text(stmt, 2, scheduled_at, strlen(scheduled_at), NULL) != SQLITE_OK) {
-        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
-        return_defer(false);
+        if (stats->imported - committed >= batch_size) {
+            if (!exec_cached(db, STMT_REFRESH_NEXT_DUE) || !commit_write(db) || !begin_write(db)) return_defer(false);
+            committed = stats->imported;
+        }
     }
 
-    if (sqlite3_bind_text(stmt, 3, period, period ? strlen(period) : 0, NULL) != SQLITE_OK) {
-        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
+    if (ferror(in)) {
+        fprintf(stderr, "ERROR: could not read calendar: %s\n", strerror(errno));
         return_defer(false);
     }
 
-    if (sqlite3_step(stmt) != SQLITE_DONE) {
-        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
-        return_defer(false);
-    }
+    if (!exec_cached(db, STMT_REFRESH_NEXT_DUE)) return_defer(false);
+    if (!end_write(db)) return_defer(false);
 
 defer:
-    if (stmt) sqlite3_finalize(stmt);
+    if (!result && !sqlite3_get_autocommit(db)) exec_cached(db, STMT_ROLLBACK);
+    free(line);
     return result;
 }
 
-typedef struct  {
-    char *items;
-    size_t count;
-    size_t capacity;
-} String_Builder;
-
-void sb_append_cstr(String_Builder *sb, const char *str)
+// Appends a content line, escaping TEXT values and folding at ICS_LINE_WIDTH
+// octets without splitting UTF-8 sequences. A line break in a TEXT value is
+// written as `\n`, raw it would end the content line.
+static void ics_append_property(String_Builder *out, const char *name, const char *value, bool text)
 {
-    size_t n = strlen(str);
-
-    if (sb->count + n >= sb->capacity) {
-        if (sb->capacity == 0) {
-            sb->capacity = SB_INIT_CAP;
+    size_t width = strlen(name) + 1;
+    sb_append_cstr(out, name);
+    sb_append_cstr(out, ":");
+
+    for (const char *p = value; *p; p++) {
+        unsigned char c = *p;
+        char buf[2] = {*p};
+        size_t n = 1;
+        if (text && c == '\r') continue;
+        if (text && (c == '\\' || c == ';' || c == ',' || c == '\n')) {
+            buf[0] = '\\';
+            buf[1] = c == '\n' ? 'n' : *p;
+            n = 2;
         }
-        while (sb->count + n >= sb->capacity) {
-            sb->capacity = sb->capacity*2; 
+
+        // A sequence is folded as a whole, so its lead byte has to make room
+        // for the continuation bytes after it
+        size_t sequence = n;
+        if (c >= 0xF0) sequence = 4;
+        else if (c >= 0xE0) sequence = 3;
+        else if (c >= 0xC0) sequence = 2;
+        if ((c & 0xC0) != 0x80 && width + sequence > ICS_LINE_WIDTH) {
+            sb_append_cstr(out, "\r\n ");
+            width = 1;
         }
-        sb->items = realloc(sb->items, sb->capacity*sizeof(sb->items));
-        assert(sb->items != NULL && "ERROR: dynamic allocation error...");
+        sb_append_buf(out, buf, n);
+        width += n;
     }
-    memcpy(sb->items+sb->count, str, n*sizeof(sb->items));
-    sb->count += n;
+    sb_append_cstr(out, "\r\n");
 }
 
-void sb_append_null(String_Builder *sb)
+static void ics_format_rrule(Recurrence r, char *buf, size_t size)
 {
-    if (sb->count >= sb->capacity) {
-        sb->capacity = sb->capacity == 0 ? 256 : sb->capacity*2; 
-        sb->items = realloc(sb->items, sb->capacity*sizeof(sb->items));
-        assert(sb->items != NULL);
-    }
-    sb->items[sb->count++] = '\0';
-}
-
-// TODO: consider valid date range (ie. month 1-12, day 1-31)
-bool valid_date_format_checker(const char *str) 
-{
-    char date_format[] = "YYYY-MM-DD";
-    char date[sizeof(date_format)] = {0};
-    size_t year_count = 0, month_count = 0, day_count = 0, pad_count = 0;
-
-    for (size_t i = 0; i < strlen(str); i++) {
-        switch (pad_count) {
-            case 0: // within the year part of the date format
-                if (isdigit(str[i])) {
-                    // fill date string with partial date format (YYYY)
-                    if (year_count >= 4) break;
-                    date[year_count++] = str[i];
-                } else if (isascii((char)str[i]) && (char)str[i] == '-') {
-                    date[year_count] = '-';
-                    pad_count++;
-                } else{
-                    return false;
-                }
-                break;
-            case 1: // within month part of the date format
-                if (isdigit(str[i])) {
-                    // fill date string with partial date format (MM)
-                    if (month_count >= 2) break;
-                    date[year_count+pad_count+month_count++] = str[i];
-                } else if (isascii((char)str[i]) && (char)str[i] == '-') {
-                    date[year_count+pad_count+month_count] = '-';
-                    pad_count++;
-                } else{
-                    return false;
-                }
-                break;
-            case 2: // within the day part of the date format
-                if (isdigit(str[i])) {
-                    if (day_count >= 2) break;
-                    // fill date string with partial date format (DD)
-                    date[year_count+pad_count+month_count+day_count++] = str[i];
-                } else if (isascii((char)str[i]) && (char)str[i] == ' ') {
-                    date[year_count+pad_count+month_count+day_count] = '\0';
-                    break;
-                } else{
-                    return false;
-                }
-                break;
-            default:
-                // Not sure the default case will ever be reached but here for sanity
-                printf("ERROR: valid date format of the form '%s' is in incorrect\n", date_format);
-                exit(1);
+    static const char *freqs[] = {
+        [RECUR_DAILY] = "DAILY", [RECUR_WEEKLY] = "WEEKLY", [RECUR_MONTHLY] = "MONTHLY", [RECUR_YEARLY] = "YEARLY",
+    };
+    int n = snprintf(buf, size, "FREQ=%s", freqs[r.kind]);
+    if (r.interval > 1) n += snprintf(buf + n, size - n, ";INTERVAL=%d", r.interval);
+
+    switch (r.kind) {
+    case RECUR_WEEKLY:
+        n += snprintf(buf + n, size - n, ";BYDAY=");
+        for (int wd = 0, first = 1; wd < 7; wd++) {
+            if (!(r.weekdays & (1 << wd))) continue;
+            n += snprintf(buf + n, size - n, "%s%s", first ? "" : ",", ics_weekdays[wd]);
+            first = 0;
+        }
+        break;
+    case RECUR_YEARLY:
+        n += snprintf(buf + n, size - n, ";BYMONTH=%d", r.month);
+        // fallthrough
+    case RECUR_MONTHLY: {
+        // Days some months lack are clamped, see `parse_rrule`
+        int shortest = recurrence_shortest_month(r);
+        if (r.month_day <= shortest) {
+            n += snprintf(buf + n, size - n, ";BYMONTHDAY=%d", r.month_day);
+        } else if (r.month_day == 31) {
+            n += snprintf(buf + n, size - n, ";BYMONTHDAY=-1");
+        } else {
+            n += snprintf(buf + n, size - n, ";BYMONTHDAY=%d", shortest);
+            for (int day = shortest + 1; day <= r.month_day; day++) n += snprintf(buf + n, size - n, ",%d", day);
+            n += snprintf(buf + n, size - n, ";BYSETPOS=-1");
         }
+        break;
+    }
+    default:
+        break;
     }
 
-    bool result = strcmp(str, date) == 0;
-    return result;
+    if (r.until) {
+        int y, m, d;
+        civil_from_days(r.until, &y, &m, &d);
+        snprintf(buf + n, size - n, ";UNTIL=%04d%02d%02d", y, m, d);
+    }
 }
 
-bool create_notes_table_with_path(sqlite3 *db, const char *notes_path)
+// Streams the unfinished reminders to `fd` as a VCALENDAR
+bool export_reminders_ics(sqlite3 *db, int fd)
 {
     bool result = true;
-    sqlite3_stmt *stmt = NULL;
+    Output out = { .fd = fd };
+    sqlite3_stmt *stmt = prepare_cached(db, STMT_EXPORT_REMINDERS);
+    if (stmt == NULL) return false;
+
+    sb_append_cstr(&out.sb, "BEGIN:VCALENDAR\r\nVERSION:2.0\r\nPRODID:-//lore//reminders//EN\r\n");
+
+    int ret;
+    while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+        char buf[128];
+        int y, m, d;
+
+        sb_append_cstr(&out.sb, "BEGIN:VEVENT\r\n");
+        snprintf(buf, sizeof(buf), "lore-reminder-%lld", (long long)sqlite3_column_int64(stmt, 0));
+        ics_append_property(&out.sb, "UID", buf, false);
+
+        time_t created_at = (time_t)sqlite3_column_int64(stmt, 4);
+        struct tm tm;
+        gmtime_r(&created_at, &tm);
+        strftime(buf, sizeof(buf), "%Y%m%dT%H%M%SZ", &tm);
+        ics_append_property(&out.sb, "DTSTAMP", buf, false);
+
+        civil_from_days(sqlite3_column_int(stmt, 2), &y, &m, &d);
+        snprintf(buf, sizeof(buf), "%04d%02d%02d", y, m, d);
+        ics_append_property(&out.sb, "DTSTART;VALUE=DATE", buf, false);
+        ics_append_property(&out.sb, "SUMMARY", (const char *)sqlite3_column_text(stmt, 1), true);
+
+        if (sqlite3_column_type(stmt, 3) != SQLITE_NULL) {
+            Recurrence r = recurrence_decode(sqlite3_column_int64(stmt, 3));
+            r.until = sqlite3_column_int(stmt, 5);
+            ics_format_rrule(r, buf, sizeof(buf));
+            ics_append_property(&out.sb, "RRULE", buf, false);
+        }
+        sb_append_cstr(&out.sb, "END:VEVENT\r\n");
 
-    int ret = sqlite3_prepare_v2(db, "SELECT COUNT(*) FROM Add_Notes;", -1, &stmt, NULL);
-    if (ret != SQLITE_OK) {
-        fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
-        return_defer(false);
+        if (!out_end_row(&out)) return_defer(false);
     }
 
-    ret = sqlite3_step(stmt);
-    if (ret != SQLITE_ROW) {
+    if (ret != SQLITE_DONE) {
         fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
         return_defer(false);
     }
 
-    int row_count = sqlite3_column_int(stmt, 0);
-    sqlite3_finalize(stmt);
-    stmt = NULL;
+    sb_append_cstr(&out.sb, "END:VCALENDAR\r\n");
+    if (!out_flush(&out)) return_defer(false);
+    trace_phase("export");
+
+defer:
+    release_cached(stmt);
+    return result;
+}
+
+bool create_notes_table_with_path(sqlite3 *db, const char *notes_path)
+{
+    bool result = true;
+    sqlite3_stmt *stmt = NULL;
+
+    int row_count = 0;
+    if (!query_int(db, STMT_COUNT_NOTES, &row_count)) return_defer(false);
+
     if (row_count >= 0) {
         // init or update the table 
-        ret = sqlite3_prepare_v2(db, "INSERT INTO Add_Notes (notes_absolute_path_name) VALUES (?);", -1, &stmt, NULL);
+        stmt = prepare_cached(db, STMT_INSERT_NOTES);
+        if (stmt == NULL) return_defer(false);
         if (sqlite3_bind_text(stmt, 1, notes_path, strlen(notes_path), NULL) != SQLITE_OK) {
             fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
             return_defer(false);
@@ -465,7 +3280,7 @@ bool create_notes_table_with_path(sqlite3 *db, const char *notes_path)
     } 
     fprintf(stderr, "UNREACHABLE");
 defer:
-    if (stmt) sqlite3_finalize(stmt);
+    if (stmt) release_cached(stmt);
     return result;
 }
 
@@ -484,221 +3299,610 @@ static bool check_file_path_with_cmd(const char* notes_path, const char *sub_cmd
     return true;
 }
 
-int main(int argc, char **argv)
-{
-    int result = 0;
-    // Create sqlite database
-    sqlite3 *db = NULL;
-    sqlite3_stmt *stmt = NULL;
-    String_Builder sb = {0};
-    const char *template = "index.tmp";
+// ** Commands **
 
-    const char *program_name = shift(argv, argc);
+typedef enum {
+    NEEDS_NOTHING,
+    NEEDS_READ_ONLY,  // read-only connection when the schema is current, see `open_database`
+    NEEDS_READ_WRITE,
+    NEEDS_NOTES,      // read-write plus $PWD to resolve note files
+} Command_Needs;
 
-    const char *cmd = "checkout";
-    if (argc > 0) cmd = shift(argv, argc);
+// What `main` set up for the running command
+typedef struct {
+    const char *program_name;
+    Command_Needs needs;
+    char lore_path[256];
+    const char *pwd;
+    sqlite3 *db;
+} Lore;
+
+// The database of the running command, opened on first use the way the
+// command declared. Commands check their arguments before asking for it, so
+// usage errors never pay for sqlite.
+sqlite3 *lore_db(Lore *lore)
+{
+    if (lore->db) return lore->db;
+
+    bool created = false;
+    Budget *budget = lore_budget.deadline_ns ? &lore_budget : NULL;
+    if (!open_database(lore->lore_path, lore->needs == NEEDS_READ_ONLY, budget, &lore->db, &created)) {
+        finalize_stmt_cache();
+        sqlite3_close(lore->db);
+        lore->db = NULL;
+        return NULL;
+    }
+    // Installed after the migrations, an upgrade has to finish at some point
+    if (budget) sqlite3_progress_handler(lore->db, BUDGET_PROGRESS_OPS, budget_progress_handler, budget);
+    if (created) { // one time execution for newly created databases
+        Output out = { .fd = STDOUT_FILENO };
+        sb_appendf(&out.sb, "Created database file here: \"%s\"\n", lore->lore_path);
+        out_flush(&out);
+    }
+    return lore->db;
+}
 
+bool resolve_lore_path(char lore_path[256])
+{
 #ifdef LOCAL
     const char *path = getenv("PWD");
     if (path == NULL) {
         fprintf(stderr, "ERROR: No $PWD environment variable is set up. We need it to find the location of the ./"LORE_FILENAME" database.\n");
+        return false;
     }
 #else
     const char *path = getenv("HOME");
     if (path == NULL) {
         fprintf(stderr, "ERROR: No $HOME environment variable is set up. We need it to find the location of the ./"LORE_FILENAME" database.\n");
+        return false;
     }
 #endif
 
-    char lore_path[256];
-    int ra = sprintf(lore_path, "%s/"LORE_FILENAME"", path); 
-
-    if (ra < 0) {
+    int ra = snprintf(lore_path, 256, "%s/"LORE_FILENAME"", path);
+    if (ra < 0 || ra >= 256) {
         fprintf(stderr, "ERROR: sprintf failed to generate file name: %s\n", LORE_FILENAME);
-        return_defer(1);
+        return false;
+    }
+    return true;
+}
+
+// Renders the snapshot from a detached child with a generous budget of its
+// own, so the next checkout is fast again after this one ran out of time. The
+// connection of the parent is closed first, sqlite connections must not cross
+// a fork. Tells the parent whether the child is on it.
+static bool refresh_snapshot_in_background(Lore *lore)
+{
+    finalize_stmt_cache();
+    sqlite3_close(lore->db);
+    lore->db = NULL;
+
+    pid_t pid = fork();
+    if (pid != 0) return pid > 0; // if fork failed the next checkout tries again
+
+    // Neither the shell nor a pipe should wait on us, which includes pipes on
+    // fds past stderr the caller handed down, e.g. from a status bar
+    setsid();
+    int null_fd = open("/dev/null", O_RDWR);
+    if (null_fd >= 0) {
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
     }
+    closefrom(STDERR_FILENO + 1);
 
-    int ret = sqlite3_open(lore_path, &db);
-    if (ret != SQLITE_OK) {
-        fprintf(stderr, "ERROR: %s: %s\n", lore_path, sqlite3_errstr(ret));
-        return_defer(1);
-    }         
+    budget_start(&lore_budget, SNAPSHOT_REFRESH_BUDGET_MS);
+    sqlite3 *db = NULL;
+    bool created = false;
+    if (open_database(lore->lore_path, true, &lore_budget, &db, &created)) write_checkout_snapshot(db);
+    _exit(0);
+}
+
+bool cmd_checkout(Lore *lore, int argc, char **argv)
+{
+    (void) argc;
+    (void) argv;
+
+    // The shell hook path: print the precomputed output without touching sqlite
+    bool hit = checkout_from_snapshot(lore->lore_path, false);
+    trace_phase(hit ? "checkout snapshot" : "checkout snapshot miss");
+    if (hit) return true;
+
+    budget_start(&lore_budget, checkout_budget_ms());
+    sqlite3 *db = lore_db(lore);
+    bool partial = false;
+    if (db != NULL && show_checkout(db, &partial)) return true;
+    if (!lore_budget.exceeded) return false;
+
+    // Out of time, the last rendered output beats a hanging terminal. Unless
+    // part of the fresh one is out already, the old one would repeat it. Not
+    // an error as long as there was something to show or the refresh started,
+    // the shell hook has nothing to act on.
+    trace_phase("checkout over budget");
+    bool shown = false;
+    if (partial) {
+        Output out = { .fd = STDOUT_FILENO };
+        sb_append_cstr(&out.sb, "(incomplete: lore could not read its database in time)\n");
+        shown = out_flush(&out);
+    } else {
+        shown = checkout_from_snapshot(lore->lore_path, true);
+    }
+    bool refreshing = refresh_snapshot_in_background(lore);
+    return shown || refreshing;
+}
+
+bool cmd_notify(Lore *lore, int argc, char **argv)
+{
+    if (argc > 0 && strcmp(*argv, "--stdin") == 0) {
+        shift(argv, argc);
+        char delim = '\n';
+        size_t batch_size = IMPORT_DEFAULT_BATCH;
+        while (argc > 0) {
+            const char *flag = shift(argv, argc);
+            if (strcmp(flag, "-0") == 0 || strcmp(flag, "--null") == 0) {
+                delim = '\0';
+            } else if (strcmp(flag, "--batch") == 0 && argc > 0 && atoi(*argv) > 0) {
+                batch_size = atoi(shift(argv, argc));
+            } else {
+                fprintf(stderr, "Usage: %s notify --stdin [-0|--null] [--batch <rows>]\n", lore->program_name);
+                fprintf(stderr, "ERROR: unexpected argument `%s`\n", flag);
+                return false;
+            }
+        }
+
+        sqlite3 *db = lore_db(lore);
+        if (db == NULL) return false;
+
+        size_t imported = 0;
+        uint64_t start = monotonic_ns();
+        if (!import_notifications(db, stdin, delim, batch_size, &imported)) return false;
+        trace_phase("import");
+
+        double secs = (monotonic_ns() - start)*1e-9;
+        fprintf(stderr, "Imported %zu notifications in %.3fs (%.0f rows/s)\n", imported, secs, secs > 0 ? imported/secs : 0.0);
+        return true;
+    }
+
+    if (argc <= 0) {
+        fprintf(stderr, "Usage: %s notify <title...> | --stdin [-0|--null] [--batch <rows>]\n", lore->program_name);
+        fprintf(stderr, "ERROR: expeced title\n");
+        return false;
+    }
 
-    if (!create_schema(db)) return_defer(1);
-    if (update_file_creation_message(db)) { // one time execution for newly created databases
-        fprintf(stdout, "Created database file here: \"%s\"\n", lore_path);
+    String_Builder sb = {0};
+    for (bool pad = false; argc > 0; pad = true) {
+        if (pad) sb_append_cstr(&sb, " ");
+        sb_append_cstr(&sb, shift(argv, argc));
     }
+    sb_append_null(&sb);
+
+    char *title = sb.items;
+
+    sqlite3 *db = lore_db(lore);
+    if (db == NULL) return false;
+    if (!begin_write(db)) return false;
+    if (!create_notification_with_title(db, title)) return false;
+    trace_phase("create_notification");
+    return end_write_and_show_notifications(db);
+}
 
-    // Fire of notifications everytime `lore` is called
-    if (strcmp(cmd, "checkout") == 0) {
-        if (!show_active_notifications(db)) return_defer(1);
-        // TODO: display reminders as well that do not specifically give `periods` (ie. period is NULL) ?
-        return_defer(0);
+bool cmd_dismiss(Lore *lore, int argc, char **argv)
+{
+    if (argc <= 0) {
+        fprintf(stderr, "Usage: %s dismiss <index[-index][,...]...> | --all | --match <text>\n", lore->program_name);
+        fprintf(stderr, "ERROR: expeced index\n");
+        return false;
     }
 
-    // TODO: extract commands into its own structure/function relationship...
-    //       can be useful to include this for some help description for commands
-    if (strcmp(cmd, "notify") == 0) {
+    sqlite3 *db = NULL;
+    const char *arg = shift(argv, argc);
+    if (strcmp(arg, "--all") == 0) {
+        if ((db = lore_db(lore)) == NULL) return false;
+        if (!begin_write(db)) return false;
+        if (!exec_cached(db, STMT_DISMISS_ALL_NOTIFICATIONS)) return false;
+    } else if (strcmp(arg, "--match") == 0) {
         if (argc <= 0) {
-            fprintf(stderr, "Usage: %s notify <title...>\n", program_name);
-            fprintf(stderr, "ERROR: expeced title\n");
-            return_defer(1);
+            fprintf(stderr, "Usage: %s dismiss --match <text>\n", lore->program_name);
+            fprintf(stderr, "ERROR: expected text to match\n");
+            return false;
+        }
+        if ((db = lore_db(lore)) == NULL) return false;
+        if (!begin_write(db)) return false;
+        if (!dismiss_notifications_matching(db, shift(argv, argc))) return false;
+    } else {
+        Index_Ranges ranges = {0};
+        for (;;) {
+            if (!parse_index_ranges(arg, &ranges)) {
+                fprintf(stderr, "ERROR: `%s` is not a list of indices like 1-20,25,30-\n", arg);
+                return false;
+            }
+            if (argc <= 0) break;
+            arg = shift(argv, argc);
         }
 
-        for (bool pad = false; argc > 0; pad = true) {
-            if (pad) sb_append_cstr(&sb, " ");
-            sb_append_cstr(&sb, shift(argv, argc));
+        if ((db = lore_db(lore)) == NULL) return false;
+        if (!begin_write(db)) return false;
+        if (ranges.count == 1 && ranges.items[0].lo == ranges.items[0].hi) {
+            if (!dismiss_notification_by_index(db, ranges.items[0].lo)) return false;
+        } else {
+            if (!dismiss_notifications_in_ranges(db, ranges)) return false;
         }
-        sb_append_null(&sb);
+    }
+    trace_phase("dismiss");
+    return end_write_and_show_notifications(db);
+}
+
+// The listings and --export only read
+Command_Needs remind_needs(int argc, char **argv)
+{
+    if (argc <= 0 || strcmp(*argv, "--export") == 0) return NEEDS_READ_ONLY;
+    // The listing windows, --today, --from <date>, ...
+    if (strncmp(*argv, "--", 2) == 0 && strcmp(*argv, "--done") != 0 && strcmp(*argv, "--import") != 0) return NEEDS_READ_ONLY;
+    return NEEDS_READ_WRITE;
+}
+
+// `parse_date` for the word that ends a reminder title. Weekday abbreviations
+// are ordinary words too (`buy sat dish`), so only full weekday names count.
+static bool parse_title_date(const char *word, int today, int *day)
+{
+    int wd = parse_weekday(word);
+    if (wd >= 0 && strcasecmp(word, weekday_names[wd]) != 0) return false;
+    return parse_date(word, today, day);
+}
+
+bool cmd_remind(Lore *lore, int argc, char **argv)
+{
+    const char *program_name = lore->program_name;
+    sqlite3 *db = NULL;
 
-        char *title = sb.items;
-                
-        if (!create_notification_with_title(db, title)) return_defer(1);
-        if (!show_active_notifications(db)) return_defer(1);
-        return_defer(0);
+    if (argc <= 0) {
+        if ((db = lore_db(lore)) == NULL) return false;
+        return show_active_reminders(db, DAY_MIN, DAY_MAX);
     }
 
-    if (strcmp(cmd, "dismiss") == 0) {
-        if (argc <= 0) {
-            fprintf(stderr, "Usage: %s dismiss <id>\n", program_name);
-            fprintf(stderr, "ERROR: expeced id\n");
-            return_defer(1);
+    if (strcmp(*argv, "--done") == 0) {
+        shift(argv, argc);
+        if (argc <= 0 || !isdigit((unsigned char)**argv)) {
+            fprintf(stderr, "Usage: %s remind --done <index>\n", program_name);
+            fprintf(stderr, "ERROR: expected index\n");
+            return false;
         }
+        if ((db = lore_db(lore)) == NULL) return false;
+        if (!begin_write(db)) return false;
+        if (!finish_reminder_by_index(db, atoi(shift(argv, argc)))) return false;
+        trace_phase("finish_reminder");
+        if (!end_write(db)) return false;
+        return show_active_reminders(db, DAY_MIN, DAY_MAX);
+    }
 
-        int index = atoi(shift(argv, argc));
-        if (!dismiss_notification_by_index(db, index)) return_defer(1);
-        if (!show_active_notifications(db)) return_defer(1);
-        return_defer(0);
+    if (strcmp(*argv, "--export") == 0) {
+        if ((db = lore_db(lore)) == NULL) return false;
+        return export_reminders_ics(db, STDOUT_FILENO);
     }
 
-    if (strcmp(cmd, "remind") == 0) {
+    if (strcmp(*argv, "--import") == 0) {
+        shift(argv, argc);
         if (argc <= 0) {
-            if (!show_active_reminders(db)) return_defer(1); // TODO: implement show reminders function
-            return_defer(0);
+            fprintf(stderr, "Usage: %s remind --import <file.ics | ->\n", program_name);
+            return false;
+        }
+        const char *file_path = shift(argv, argc);
+        FILE *in = strcmp(file_path, "-") == 0 ? stdin : fopen(file_path, "r");
+        if (in == NULL) {
+            fprintf(stderr, "ERROR: %s: %s\n", file_path, strerror(errno));
+            return false;
         }
-        char *tmp = NULL;
 
-        for (bool pad = false; argc > 0; pad = true) {
-            if (valid_date_format_checker(*argv)) {
-                tmp = *argv;
+        Ics_Stats stats = {0};
+        uint64_t start = monotonic_ns();
+        bool ok = (db = lore_db(lore)) != NULL && import_reminders_ics(db, in, IMPORT_DEFAULT_BATCH, &stats);
+        if (in != stdin) fclose(in);
+        if (!ok) return false;
+        trace_phase("import");
+
+        double secs = (monotonic_ns() - start)*1e-9;
+        fprintf(stderr, "Imported %zu reminders in %.3fs, skipped %zu events", stats.imported, secs, stats.skipped);
+        if (stats.simplified > 0) fprintf(stderr, ", %zu unsupported RRULEs imported as one-off reminders", stats.simplified);
+        if (stats.unsupported > 0) fprintf(stderr, ", skipped %zu series with unsupported RRULEs that started in the past", stats.unsupported);
+        fprintf(stderr, "\n");
+        return true;
+    }
+
+    if (strncmp(*argv, "--", 2) == 0) {
+        int today = local_today();
+        int from = DAY_MIN, to = DAY_MAX;
+        while (argc > 0) {
+            const char *flag = shift(argv, argc);
+            if (strcmp(flag, "--today") == 0) {
+                from = to = today;
+            } else if (strcmp(flag, "--week") == 0) {
+                from = today;
+                to = today + 6;
+            } else if (strcmp(flag, "--overdue") == 0) {
+                from = DAY_MIN;
+                to = today - 1;
+            } else if ((strcmp(flag, "--from") == 0 || strcmp(flag, "--to") == 0) &&
+                       argc > 0 && parse_date(*argv, today, strcmp(flag, "--from") == 0 ? &from : &to)) {
                 shift(argv, argc);
-                break;
             } else {
-                if (pad) sb_append_cstr(&sb, " ");
-                sb_append_cstr(&sb, shift(argv, argc));
+                fprintf(stderr, "Usage: %s remind [--today | --week | --overdue | --from <date> | --to <date>]\n", program_name);
+                fprintf(stderr, "ERROR: unexpected argument `%s`, dates are YYYY-MM-DD, today, tomorrow, +3d, +2w or a weekday\n", flag);
+                return false;
             }
         }
-        sb_append_null(&sb);
-        const char *title = sb.items;
-        const char *scheduled_at = tmp;
+        if ((db = lore_db(lore)) == NULL) return false;
+        return show_active_reminders(db, from, to);
+    }
 
-        if (scheduled_at != NULL) {
-            if (argc > 0) {
-                // Optional [period] is present for reminders to periodically fire off
-                // TODO: implement periodic reminder scheduling
-                assert(0 && "NOT IMPLEMENTED: periodically perform this reminder");
-            }
+    // The title runs up to the first word after it that parses as a date
+    String_Builder sb = {0};
+    int today = local_today();
+    int scheduled_at = 0;
+    bool has_date = false;
+    for (bool pad = false; argc > 0 && !has_date; pad = true) {
+        if (pad && parse_title_date(*argv, today, &scheduled_at)) {
+            has_date = true;
+            shift(argv, argc);
         } else {
-            fprintf(stderr, "Usage: %s remind [<title> <date> [period]]\n", program_name);
-            fprintf(stderr, "ERROR: expected date: YYYY-MM-DD\n");
-            return_defer(1);
+            if (pad) sb_append_cstr(&sb, " ");
+            sb_append_cstr(&sb, shift(argv, argc));
+        }
+    }
+    sb_append_null(&sb);
+    const char *title = sb.items;
+
+    Recurrence recurrence = {0};
+    if (has_date) {
+        if (argc > 0) {
+            // Optional [period] is present for reminders to periodically fire off
+            String_Builder spec = {0};
+            const char *until = NULL;
+            for (bool pad = false; argc > 0; pad = true) {
+                if (strcmp(*argv, "until") == 0 && argc == 2) {
+                    shift(argv, argc);
+                    until = shift(argv, argc);
+                    break;
+                }
+                if (pad) sb_append_cstr(&spec, " ");
+                sb_append_cstr(&spec, shift(argv, argc));
+            }
+            sb_append_null(&spec);
+            if (!parse_recurrence(spec.items, scheduled_at, &recurrence)) {
+                fprintf(stderr, "ERROR: unknown period `%s`, expected e.g. daily, weekdays, weekly on mon,thu, monthly on 15, every 2 weeks, yearly [until <date>]\n", spec.items);
+                return false;
+            }
+            if (until && !parse_date(until, today, &recurrence.until)) {
+                fprintf(stderr, "ERROR: `%s` is not a valid date\n", until);
+                return false;
+            }
+            // The first occurrence might come after the given date, `weekly on mon` from a Saturday
+            scheduled_at = recurrence_on_or_after(recurrence, scheduled_at, scheduled_at);
+            if (recurrence.until && scheduled_at > recurrence.until) {
+                fprintf(stderr, "ERROR: the period has no occurrence until %s\n", until);
+                return false;
+            }
+        }
+    } else {
+        fprintf(stderr, "Usage: %s remind [<title> <date> [period]] | [--today | --week | --overdue | --from <date> | --to <date>] | --done <index>\n", program_name);
+        fprintf(stderr, "ERROR: expected date: YYYY-MM-DD, today, tomorrow, +3d, +2w or a weekday name\n");
+        return false;
+    }
+
+    if ((db = lore_db(lore)) == NULL) return false;
+    if (!begin_write(db)) return false;
+    if (!create_new_reminder(db, title, scheduled_at, recurrence.kind ? &recurrence : NULL)) return false; // just like reminders but `scheduled_at` is optionally NULL
+    trace_phase("create_reminder");
+    if (!end_write(db)) return false;
+    return true;
+}
+
+bool cmd_scheduler(Lore *lore, int argc, char **argv)
+{
+    (void) argc;
+    (void) argv;
+
+    sqlite3 *db = lore_db(lore);
+    if (db == NULL) return false;
+    return run_scheduler(db);
+}
+
+bool cmd_cal(Lore *lore, int argc, char **argv)
+{
+    Calendar cal;
+    if (argc > 1 || !parse_calendar_range(argc > 0 ? *argv : NULL, local_today(), &cal)) {
+        fprintf(stderr, "Usage: %s cal [month | year | YYYY | YYYY-MM | <month name>]\n", lore->program_name);
+        return false;
+    }
+
+    sqlite3 *db = lore_db(lore);
+    if (db == NULL) return false;
+    return show_calendar(db, &cal);
+}
+
+bool cmd_notes(Lore *lore, int argc, char **argv)
+{
+    bool result = true;
+    sqlite3_stmt *stmt = NULL;
+    String_Builder sb = {0};
+    const char *template = "index.tmp";
+    const char *program_name = lore->program_name;
+
+    if (argc <= 0) {
+        fprintf(stderr, "Usage: %s notes <add> <open>\n", program_name);
+        return_defer(false);
+    }
+
+    char *notes_cmd = shift(argv, argc);
+
+    if(strcmp(notes_cmd, "add") == 0) {
+        if (argc <= 0) {
+            fprintf(stderr, "Usage: %s notes <add> <file_name>\n", program_name);
+            return_defer(false);
+        }
+        const char *file_name = shift(argv, argc);
+        sb_append_cstr(&sb, lore->pwd);
+        sb_append_cstr(&sb, "/");
+        sb_append_cstr(&sb, file_name);
+        //printf("%.*s\n", (int) sb.count, sb.items);
+        const char *notes_path = sb.items;
+
+        // TODO: allow only certain filetypes ?
+        if (!check_file_path_with_cmd(notes_path, notes_cmd)) {
+            fprintf(stderr, "ERROR: file name: `%s` does not exist\n", file_name);
+            return_defer(false);
+        }
+        fprintf(stderr, "WARNING: `%s` file type may not be supported in the browser\n", file_name);
+
+        sqlite3 *db = lore_db(lore);
+        if (db == NULL) return_defer(false);
+        stmt = prepare_cached(db, STMT_LOAD_NOTES_PATHS);
+        if (stmt == NULL) return_defer(false);
+
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            int row_id = sqlite3_column_int(stmt, 0);
+            const unsigned char *notes_path_query = sqlite3_column_text(stmt, 1);
+            if (strcmp(notes_path, (const char*)notes_path_query) == 0) {
+                fprintf(stderr, "Path already exists in database: (%d, %s)\n", row_id, notes_path_query);
+                return_defer(false);
+            }
         }
 
-        if (!create_new_reminder(db, title, scheduled_at, NULL)) return_defer(1); // just like reminders but `scheduled_at` is optionally NULL
-        return_defer(0);
+        if (argc <= 0) {
+            if (!create_notes_table_with_path(db, notes_path)) return_defer(false);
+            return_defer(true);
+        }
     }
 
-    if (strcmp(cmd, "notes") == 0) {
-        printf("%d [%s]\n", argc, *argv);
+    if(strcmp(notes_cmd, "open") == 0) {
         if (argc <= 0) {
-            fprintf(stderr, "Usage: %s notes <add> <open>\n", program_name);
-            return_defer(1);
+            // TODO: For now implement just opening all the default primary
+            // file names. Later can work out the opening the file logic and
+            // performing some DSL related parsing to obtain information for
+            // changing the default file name? or some other need for such
+            // functionality
+
+            sqlite3 *db = lore_db(lore);
+            if (db == NULL) return_defer(false);
+            if (!generate_html_and_open(db, template)) return_defer(false);
+            return_defer(true);
         }
+    }
 
-        char *notes_cmd = shift(argv, argc);
+    sb_append_cstr(&sb, notes_cmd);
+    while (argc > 0) {
+        sb_append_cstr(&sb, " ");
+        sb_append_cstr(&sb, shift(argv, argc));
+    }
+    fprintf(stderr, "ERROR: unknown command %.*s\n", (int) sb.count, sb.items);
+    return_defer(false);
 
-        if(strcmp(notes_cmd, "add") == 0) {
-            if (argc <= 0) {
-                fprintf(stderr, "Usage: %s notes <add> <file_name>\n", program_name);
-                return_defer(1);
-            }
-            const char *file_name = shift(argv, argc);
-            char *pwd = getenv("PWD");
-            sb_append_cstr(&sb, pwd);
-            sb_append_cstr(&sb, "/");
-            sb_append_cstr(&sb, file_name);
-            //printf("%.*s\n", (int) sb.count, sb.items);
-            const char *notes_path = sb.items; 
-                                               
-            // TODO: allow only certain filetypes ?
-            if (!check_file_path_with_cmd(notes_path, notes_cmd)) {
-                fprintf(stderr, "ERROR: file name: `%s` does not exist\n", file_name);
-                return_defer(1);
-            } 
-            fprintf(stderr, "WARNING: `%s` file type may not be supported in the browser\n", file_name);
-
-            int ret = sqlite3_prepare_v2(db, "SELECT id, notes_absolute_path_name from Add_Notes;", -1, &stmt, NULL);
-            if (ret != SQLITE_OK) {
-                fprintf(stderr, "SQLITE3 ERROR: %s\n", sqlite3_errmsg(db));
-                return_defer(1);
-            }
+defer:
+    if (stmt) release_cached(stmt);
+    return result;
+}
 
-            while (sqlite3_step(stmt) == SQLITE_ROW) {
-                int row_id = sqlite3_column_int(stmt, 0);
-                const unsigned char *notes_path_query = sqlite3_column_text(stmt, 1);
-                if (strcmp(notes_path, (const char*)notes_path_query) == 0) {
-                    fprintf(stderr, "Path already exists in database: (%d, %s)\n", row_id, notes_path_query);
-                    return_defer(1);
-                }
-            }
-            
-            if (argc <= 0) {
-                if (!create_notes_table_with_path(db, notes_path)) return_defer(1);
-                return_defer(0);
-            }
-        } 
-
-        if(strcmp(notes_cmd, "open") == 0) {
-            if (argc <= 0) {
-                // TODO: For now implement just opening all the default primary
-                // file names. Later can work out the opening the file logic and
-                // performing some DSL related parsing to obtain information for
-                // changing the default file name? or some other need for such 
-                // functionality
-
-                if (!generate_html_and_open(db, template)) return_defer(1);
-                return_defer(0);
-            }
-        }
+bool cmd_help(Lore *lore, int argc, char **argv);
+
+typedef struct {
+    const char *name;
+    Command_Needs needs;
+    Command_Needs (*needs_for_args)(int argc, char **argv); // overrides `needs` when set
+    bool (*run)(Lore *lore, int argc, char **argv);
+    const char *usage;
+    const char *description;
+} Command;
+
+static const Command commands[] = {
+    {"checkout",  NEEDS_READ_ONLY,  NULL,         cmd_checkout,  "",
+     "Show the active notifications and the reminders due today. The default command. Gives up after\n"
+     "        LORE_CHECKOUT_BUDGET_MS (default "STR(CHECKOUT_BUDGET_MS_DEFAULT)", 0 for none) and shows the last output instead"},
+    {"notify",    NEEDS_READ_WRITE, NULL,         cmd_notify,    "<title...> | --stdin [-0|--null] [--batch <rows>]",
+     "Add a notification, or one per line of stdin"},
+    {"dismiss",   NEEDS_READ_WRITE, NULL,         cmd_dismiss,   "<index[-index][,...]...> | --all | --match <text>",
+     "Dismiss notifications by position, all of them or the ones matching a text"},
+    {"remind",    NEEDS_READ_WRITE, remind_needs, cmd_remind,    "[<title> <date> [period] [until <date>]] | [--today | --week | --overdue | --from <date> | --to <date>] | --done <index> | --import <file.ics | -> | --export",
+     "Add a reminder, list them, finish one or move them in and out of iCalendar files"},
+    {"cal",       NEEDS_READ_ONLY,  NULL,         cmd_cal,       "[month | year | YYYY | YYYY-MM | <month name>]",
+     "Show a calendar with the days that have reminders"},
+    {"scheduler", NEEDS_READ_WRITE, NULL,         cmd_scheduler, "",
+     "Keep running and deliver reminders as notifications when they come due"},
+    {"notes",     NEEDS_NOTES,      NULL,         cmd_notes,     "add <file_name> | open",
+     "Track note files of the current directory and open them in the browser"},
+    {"help",      NEEDS_NOTHING,    NULL,         cmd_help,      "",
+     "Show this help"},
+};
+
+bool cmd_help(Lore *lore, int argc, char **argv)
+{
+    (void) argc;
+    (void) argv;
+
+    Output out = { .fd = STDOUT_FILENO };
+    sb_appendf(&out.sb, "Usage: %s [command] [arguments]\n\n", lore->program_name);
+    sb_append_cstr(&out.sb, "Commands:\n");
+    for (size_t i = 0; i < sizeof(commands)/sizeof(commands[0]); i++) {
+        sb_appendf(&out.sb, "    %s%s%s\n", commands[i].name, *commands[i].usage ? " " : "", commands[i].usage);
+        sb_appendf(&out.sb, "        %s\n", commands[i].description);
+    }
+    sb_append_cstr(&out.sb, "\nDates are YYYY-MM-DD, today, tomorrow, yesterday, +3d, -1w or a weekday. After a\n");
+    sb_append_cstr(&out.sb, "reminder title the weekday is spelled out, `friday` rather than `fri`.\n");
+    sb_append_cstr(&out.sb, "Periods are e.g. daily, weekdays, weekly on mon,thu, monthly on 15, every 2 weeks or yearly.\n");
+    return out_flush(&out);
+}
+
+const Command *find_command(const char *name)
+{
+    for (size_t i = 0; i < sizeof(commands)/sizeof(commands[0]); i++) {
+        if (strcmp(commands[i].name, name) == 0) return &commands[i];
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+    Lore lore = {0};
+
+    trace_init();
+    lore.program_name = shift(argv, argc);
+
+    const char *cmd = "checkout";
+    if (argc > 0) cmd = shift(argv, argc);
 
-        sb_append_cstr(&sb, notes_cmd);
+    const Command *command = find_command(cmd);
+    if (command == NULL) {
+        String_Builder unknown_commands = {0};
+        sb_append_cstr(&unknown_commands, cmd);
         while (argc > 0) {
-            sb_append_cstr(&sb, " ");
-            sb_append_cstr(&sb, shift(argv, argc));
+            sb_append_cstr(&unknown_commands, " ");
+            sb_append_cstr(&unknown_commands, shift(argv, argc));
         }
-        fprintf(stderr, "ERROR: unknown command %.*s\n", (int) sb.count, sb.items);
+        fprintf(stderr, "ERROR: unknown command(s): %.*s\n", (int) unknown_commands.count, unknown_commands.items);
+        fprintf(stderr, "Run `%s help` for the list of commands\n", lore.program_name);
         return_defer(1);
     }
 
-    String_Builder unknown_commands = {0};
-    sb_append_cstr(&unknown_commands, cmd);
-    while (argc > 0) {
-        sb_append_cstr(&unknown_commands, " ");
-        sb_append_cstr(&unknown_commands, shift(argv, argc));
+    // Set up only what the command declared, the database itself is opened
+    // lazily by `lore_db`
+    lore.needs = command->needs_for_args ? command->needs_for_args(argc, argv) : command->needs;
+    if (lore.needs != NEEDS_NOTHING && !resolve_lore_path(lore.lore_path)) return_defer(1);
+    if (lore.needs == NEEDS_NOTES) {
+        lore.pwd = getenv("PWD");
+        if (lore.pwd == NULL) {
+            fprintf(stderr, "ERROR: No $PWD environment variable is set up. We need it to find the note files.\n");
+            return_defer(1);
+        }
     }
-    fprintf(stderr, "ERROR: unknown command(s): %.*s\n", (int) unknown_commands.count, unknown_commands.items);
-    free(unknown_commands.items);
-    return_defer(1);
+    trace_phase("startup");
+
+    if (!command->run(&lore, argc, argv)) return_defer(1);
 
 defer:
-    if (stmt) sqlite3_finalize(stmt);
-    if (db) sqlite3_close(db);
-    free(sb.items);
+    trace_report(cmd);
+    finalize_stmt_cache();
+    if (lore.db) sqlite3_close(lore.db);
+    arena_free(&lore_arena);
     return result;
 }
 
-
 // ** TODOs for application design **
 // TODO: display all notes in browser with paths to each file
-// TODO: calender output for reminders. Think of `ncal -C` linux tool
-// TODO: implement help menu functionality
@@ -0,0 +1,287 @@
+// Concurrency stress driver used by ./stress.sh
+//
+// Spawns readers and writers that run lore in a loop against the same database
+// for a fixed time, like a tmux session restore racing cron jobs. Reports the
+// throughput, wall time percentiles, failed runs (e.g. SQLITE_BUSY) and runs
+// that fell back to stale or incomplete output of each role and appends them as
+// JSON lines to the output file.
+#define _GNU_SOURCE // pipe2
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "driver.h"
+
+typedef enum {
+    ROLE_READER,
+    ROLE_WRITER,
+    COUNT_ROLES,
+} Role;
+
+static const char *role_names[COUNT_ROLES] = {
+    [ROLE_READER] = "readers",
+    [ROLE_WRITER] = "writers",
+};
+
+// Each role cycles through its commands, writers notify and dismiss in turn
+// so the number of active notifications stays put
+static const char *reader_commands[][4] = {
+    {"checkout"},
+    {"remind", "--today"},
+};
+static const char *writer_commands[][4] = {
+    {"notify", "stress", "notification"},
+    {"dismiss", "0"},
+};
+
+// What a worker sends to the driver for every run. Small enough for pipe
+// writes to be atomic, so all workers share a single pipe.
+typedef struct {
+    uint8_t role;
+    uint8_t ok;
+    uint8_t fallback;
+    float wall_ms;
+} Sample;
+
+typedef struct {
+    double *items;
+    size_t count;
+    size_t capacity;
+    size_t failures;
+    size_t fallbacks;
+} Samples;
+
+// Over its latency budget checkout exits 0 with the last snapshot or a cut
+// short render, announced on a line of their own. Those runs succeeded but did
+// not show current data, so they are counted apart from the failures.
+static const char *fallback_markers[] = {
+    "(stale:",
+    "(incomplete:",
+};
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e3 + ts.tv_nsec*1e-6;
+}
+
+// Drains the output of a run and tells whether a line starts with one of the
+// `fallback_markers`
+static bool read_fallback_output(int fd)
+{
+    char buf[4096];
+    char line[16];
+    size_t line_len = 0;
+    bool fallback = false;
+
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            if (buf[i] == '\n') {
+                line_len = 0;
+                continue;
+            }
+            if (line_len == sizeof(line)) continue;
+            line[line_len++] = buf[i];
+            for (size_t m = 0; m < sizeof(fallback_markers)/sizeof(fallback_markers[0]); m++) {
+                size_t len = strlen(fallback_markers[m]);
+                if (line_len == len && memcmp(line, fallback_markers[m], len) == 0) fallback = true;
+            }
+        }
+    }
+    return fallback;
+}
+
+// Readers get their stdout piped back to look for `fallback_markers`, writers
+// print nothing worth reading
+static bool run_once(const char *lore, const char **args, bool read_output, int err_fd, double *wall_ms, bool *fallback)
+{
+    const char *argv[8] = {lore};
+    for (size_t i = 0; i < 4 && args[i]; i++) argv[i + 1] = args[i];
+    int out_fds[2] = {-1, -1};
+    *fallback = false;
+
+    // Close-on-exec, lore and whatever it forks must not hold on to any pipe
+    // end but the stdout it was given, or the read below waits for them too
+    if (read_output && pipe2(out_fds, O_CLOEXEC) < 0) return false;
+    double start = now_ms();
+    pid_t pid = fork();
+    if (pid < 0) {
+        if (out_fds[0] >= 0) close(out_fds[0]);
+        if (out_fds[1] >= 0) close(out_fds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (read_output) {
+            close(out_fds[0]);
+            dup2(out_fds[1], STDOUT_FILENO);
+        } else if (null_fd >= 0) {
+            dup2(null_fd, STDOUT_FILENO);
+        }
+        dup2(err_fd >= 0 ? err_fd : null_fd, STDERR_FILENO);
+        if (read_output) close(out_fds[1]);
+        if (null_fd > STDERR_FILENO) close(null_fd);
+        execvp(lore, (char **)argv);
+        _exit(127);
+    }
+
+    if (read_output) {
+        close(out_fds[1]);
+        *fallback = read_fallback_output(out_fds[0]);
+        close(out_fds[0]);
+    }
+    int status = 0;
+    if (waitpid(pid, &status, 0) < 0) return false;
+    *wall_ms = now_ms() - start;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void worker(Role role, int id, const char *lore, double deadline_ms, int out_fd, int err_fd)
+{
+    size_t count = role == ROLE_READER ? sizeof(reader_commands)/sizeof(reader_commands[0])
+                                       : sizeof(writer_commands)/sizeof(writer_commands[0]);
+    for (size_t i = id; now_ms() < deadline_ms; i++) {
+        const char **args = role == ROLE_READER ? reader_commands[i % count] : writer_commands[i % count];
+        double wall_ms = 0;
+        bool fallback = false;
+        bool ok = run_once(lore, args, role == ROLE_READER, err_fd, &wall_ms, &fallback);
+        Sample sample = { .role = role, .ok = ok, .fallback = fallback, .wall_ms = (float)wall_ms };
+        if (write(out_fd, &sample, sizeof(sample)) != sizeof(sample)) break;
+    }
+    _exit(0);
+}
+
+static void samples_append(Samples *s, double wall_ms)
+{
+    if (s->count >= s->capacity) {
+        s->capacity = s->capacity == 0 ? 1024 : s->capacity*2;
+        s->items = realloc(s->items, s->capacity*sizeof(*s->items));
+        if (s->items == NULL) {
+            fprintf(stderr, "ERROR: out of memory\n");
+            exit(1);
+        }
+    }
+    s->items[s->count++] = wall_ms;
+}
+
+static void usage(const char *program_name)
+{
+    fprintf(stderr, "Usage: %s -l <label> -r <readers> -w <writers> -d <seconds> -o <results.jsonl> [-e <stderr log>] -- <lore>\n", program_name);
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+    const char *program_name = shift(argv, argc);
+    const char *label = NULL, *output = NULL, *err_log = NULL;
+    const char *readers_arg = "0", *writers_arg = "0", *seconds_arg = "0";
+    Samples samples[COUNT_ROLES] = {0};
+    int fds[2] = {-1, -1};
+    int err_fd = -1;
+    FILE *out = NULL;
+
+    Flag flags[] = {
+        { "-l", &label },
+        { "-r", &readers_arg },
+        { "-w", &writers_arg },
+        { "-d", &seconds_arg },
+        { "-o", &output },
+        { "-e", &err_log },
+    };
+    bool parsed = parse_flags(&argc, &argv, flags, sizeof(flags)/sizeof(flags[0]));
+    int workers[COUNT_ROLES] = {
+        [ROLE_READER] = atoi(readers_arg),
+        [ROLE_WRITER] = atoi(writers_arg),
+    };
+    double seconds = atof(seconds_arg);
+    if (!parsed || label == NULL || output == NULL || seconds <= 0 || workers[ROLE_READER] + workers[ROLE_WRITER] <= 0 || argc != 1) {
+        usage(program_name);
+        return 1;
+    }
+    const char *lore = *argv;
+
+    if (err_log) {
+        err_fd = open(err_log, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (err_fd < 0) {
+            fprintf(stderr, "ERROR: %s: %s\n", err_log, strerror(errno));
+            return_defer(1);
+        }
+    }
+
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+        fprintf(stderr, "ERROR: pipe: %s\n", strerror(errno));
+        return_defer(1);
+    }
+
+    double start_ms = now_ms();
+    double deadline_ms = start_ms + seconds*1e3;
+    for (Role role = 0; role < COUNT_ROLES; role++) {
+        for (int id = 0; id < workers[role]; id++) {
+            pid_t pid = fork();
+            if (pid < 0) {
+                fprintf(stderr, "ERROR: fork: %s\n", strerror(errno));
+                return_defer(1);
+            }
+            if (pid == 0) {
+                close(fds[0]);
+                worker(role, id, lore, deadline_ms, fds[1], err_fd);
+            }
+        }
+    }
+    close(fds[1]);
+    fds[1] = -1;
+
+    // Workers exit at the deadline, which closes the last write ends
+    Sample sample;
+    ssize_t n;
+    while ((n = read(fds[0], &sample, sizeof(sample))) == sizeof(sample)) {
+        if (sample.role >= COUNT_ROLES) continue;
+        samples_append(&samples[sample.role], sample.wall_ms);
+        if (!sample.ok) samples[sample.role].failures++;
+        if (sample.fallback) samples[sample.role].fallbacks++;
+    }
+    while (wait(NULL) > 0);
+    double elapsed_s = (now_ms() - start_ms)*1e-3;
+
+    out = fopen(output, "a");
+    if (out == NULL) {
+        fprintf(stderr, "ERROR: %s: %s\n", output, strerror(errno));
+        return_defer(1);
+    }
+
+    for (Role role = 0; role < COUNT_ROLES; role++) {
+        Samples *s = &samples[role];
+        if (workers[role] == 0) continue;
+        sort_doubles(s->items, s->count);
+        double p50 = percentile(s->items, s->count, 0.50);
+        double p99 = percentile(s->items, s->count, 0.99);
+        double max = percentile(s->items, s->count, 1.0);
+
+        printf("%-32s %-7s x%-3d %7zu runs %9.1f/s  p50 %8.3fms  p99 %8.3fms  max %8.3fms  failures %zu  fallbacks %zu\n",
+               label, role_names[role], workers[role], s->count, s->count/elapsed_s, p50, p99, max, s->failures, s->fallbacks);
+        fprintf(out, "{\"label\":");
+        json_string(out, label);
+        fprintf(out, ",\"role\":\"%s\",\"workers\":%d,\"seconds\":%.3f,\"runs\":%zu,\"runs_per_s\":%.1f,"
+                     "\"failures\":%zu,\"fallbacks\":%zu,\"p50_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f}\n",
+                role_names[role], workers[role], elapsed_s, s->count, s->count/elapsed_s,
+                s->failures, s->fallbacks, p50, p99, max);
+        if (s->failures > 0) result = 1;
+    }
+
+defer:
+    if (out) fclose(out);
+    if (fds[0] >= 0) close(fds[0]);
+    if (fds[1] >= 0) close(fds[1]);
+    if (err_fd >= 0) close(err_fd);
+    for (Role role = 0; role < COUNT_ROLES; role++) free(samples[role].items);
+    return result;
+}
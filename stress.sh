@@ -0,0 +1,43 @@
+#!/bin/bash -e
+
+# Concurrency stress test: many lore processes on one database at once.
+#
+# Builds lore and the stress driver, then runs readers (checkout, remind
+# --today) and writers (notify, dismiss) against a fresh database for a while
+# and reports throughput, latency, failed runs and runs that fell back to
+# stale or incomplete checkout output per role. Results are appended as JSON
+# lines to $STRESS_OUT, failing runs log their stderr to $STRESS_DIR/errors.log.
+# Exits non-zero if any run failed, fallbacks are expected under contention.
+#
+#   $ ./stress.sh
+#   $ STRESS_READERS=32 STRESS_WRITERS=8 STRESS_SECONDS=30 ./stress.sh
+#   $ LORE=/usr/local/bin/lore ./stress.sh     # skip building, stress this binary
+
+BUILD_DIR="./build/"
+STRESS_DIR=$BUILD_DIR"stress/"
+STRESS_READERS=${STRESS_READERS:-16}
+STRESS_WRITERS=${STRESS_WRITERS:-4}
+STRESS_SECONDS=${STRESS_SECONDS:-10}
+STRESS_NOTIFICATIONS=${STRESS_NOTIFICATIONS:-1000}   # active before the run
+REV=$(git rev-parse --short HEAD 2> /dev/null || echo "unknown")
+STRESS_OUT=${STRESS_OUT:-$STRESS_DIR"results-$REV.jsonl"}
+
+if [ -z "$LORE" ]; then
+    ./build.sh home
+    LORE=$BUILD_DIR"lore"
+fi
+LORE=$(realpath "$LORE")
+
+mkdir -p $STRESS_DIR
+gcc -O2 -Wall -Wextra -o $STRESS_DIR"stress" stress.c
+STRESS=$(realpath $STRESS_DIR"stress")
+
+WORK_DIR=$(realpath $STRESS_DIR)"/work"
+rm -rf "$WORK_DIR" $STRESS_DIR"errors.log"
+mkdir -p "$WORK_DIR"
+seq "$STRESS_NOTIFICATIONS" | sed 's/^/stress seed /' | HOME=$WORK_DIR "$LORE" notify --stdin > /dev/null 2>&1
+
+echo "Writing results to $STRESS_OUT"
+HOME=$WORK_DIR "$STRESS" -l "notifications=$STRESS_NOTIFICATIONS" \
+    -r "$STRESS_READERS" -w "$STRESS_WRITERS" -d "$STRESS_SECONDS" \
+    -o "$STRESS_OUT" -e $STRESS_DIR"errors.log" -- "$LORE"